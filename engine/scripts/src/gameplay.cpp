@@ -44,11 +44,37 @@ static void inline_dyncall_handler()
 	return_fast();
 }
 
+static void hashed_dyncall_handler()
+{
+	DynamicCall("Test::void")();
+	DynamicCall("Test::void")();
+	DynamicCall("Test::void")();
+	DynamicCall("Test::void")();
+	return_fast();
+}
+
 PUBLIC(void public_donothing())
 {
 	/* nothing */
 }
 
+PUBLIC(int touch_memory())
+{
+	/* Reads and writes 64KB, for comparing memory access costs */
+	static std::array<int, 16384> buffer;
+	int sum = 0;
+	for (auto& value : buffer)
+		sum += value++;
+	return sum;
+}
+
+PUBLIC(void nested_call(int depth))
+{
+	/* Calls back into the engine, which calls this function again */
+	if (depth > 0)
+		DynamicCall("Test::nested")(depth - 1);
+}
+
 inline void* sys_memset(void* vdest, const int ch, std::size_t size)
 {
 	register char*   a0 asm("a0") = (char*)vdest;
@@ -81,6 +107,7 @@ PUBLIC(void benchmarks())
 	//measure("Direct thread creation overhead", direct_thread_function);
 	measure("Dynamic call handler x4 (inline)", inline_dyncall_handler);
 	measure("Dynamic call handler x4 (call)", opaque_dyncall_handler);
+	measure("Dynamic call handler x4 (hash)", hashed_dyncall_handler);
 
 	measure("Allocate 1024-bytes, and free it", bench_alloc_free);
 }
@@ -2,7 +2,13 @@
 
 #include <api/embedded_string.hpp>
 #include <script/event.hpp>
+#include <script/script_loader.hpp>
 #include <strf/to_cfile.hpp>
+#ifdef EMBEDDED_MODE
+// The gameplay program is embedded with objcopy, see: CMakeLists.txt
+extern const char _binary_gameplay_elf_start[];
+extern const char _binary_gameplay_elf_end[];
+#endif
 
 int main()
 {
@@ -30,33 +36,53 @@ int main()
 	Script::set_global_setting("benchmarks", do_benchmarks);
 	Script::set_global_setting("remote", do_remote);
 
+	/* The programs have no dependencies on each other during their
+	   initialization, so they are booted in parallel. */
+	ScriptLoader loader;
 	/* The event_loop function can be resumed later, and can execute work
 	   that has been preemptively handed to it from other machines. */
-	auto events = Script("events", "scripts/gameplay.elf", debug);
+#ifdef EMBEDDED_MODE
+	/* The embedded program is used directly, without making a copy. */
+	loader.add(ProgramCache::insert(Program::from_embedded(
+		{_binary_gameplay_elf_start, size_t(_binary_gameplay_elf_end - _binary_gameplay_elf_start)},
+		"gameplay.elf")), "events", "gameplay.elf", debug);
+#else
+	/* The program file is memory-mapped and shared by all its instances. */
+	loader.add("events", "scripts/gameplay.elf", debug);
+#endif
+	loader.add("level1", "scripts/level1.elf", debug);
+	loader.add("level2", "scripts/level2.elf", debug);
+	auto scripts = loader.load();
+	Script& events = *scripts[0];
+	Script& level1 = *scripts[1];
+	Script& level2 = *scripts[2];
+
+	/* Capture the initialized state of the program, so that clones
+	   can be forked from it instead of running through main() again. */
+	events.snapshot();
 	/* A VM function call. The function is looked up in the symbol table
 	   of the program binary. Without an entry in the table, we cannot
 	   know the address of the function, even if it exists in the code. */
 	assert(events.address_of("event_loop") != 0x0);
 	events.call("event_loop");
 
-	/* Create the gameplay machine by cloning 'events' (same binary, but new instance) */
+	/* Create the gameplay machine by cloning 'events' (same binary, but new instance).
+	   The clone starts from the snapshot, and does not see the running event loop. */
 	auto gameplay = events.clone("gameplay");
 
-	/* This is the main start function, which would be something like the
-	   starting function for the current levels script. You can find the
-	   implementation in scripts/src/level1.cpp. */
-	auto level1 = Script("level1", "scripts/level1.elf", debug);
 	/* level1 make remote calls to the gameplay program. */
 	level1.setup_remote_calls_to(gameplay);
 
+	/* This is the main start function, which would be something like the
+	   starting function for the current levels script. You can find the
+	   implementation in scripts/src/level1.cpp. */
 	if (!level1.call("start")) {
 		strf::to(stdout)("Level1 failed to start!\n");
 		return 1;
 	}
 
-	/* Use strict remote calls for level2 */
-	auto level2 = Script("level2", "scripts/level2.elf", debug);
-	/* level2 can make remote calls to the gameplay program. */
+	/* Use strict remote calls for level2.
+	   level2 can make remote calls to the gameplay program. */
 	level2.setup_strict_remote_calls_to(gameplay);
 	/* Allow calling *only* this function remotely, when in strict mode */
 	gameplay.add_allowed_remote_function("_Z25gameplay_allowed_functioni");
@@ -159,6 +185,43 @@ int main()
 	{
 		// Benchmarks of various features
 		gameplay.call("benchmarks");
+		// Calls by name vs calls through a function handle
+		static constexpr auto donothing = "public_donothing"_fn;
+		strf::to(stdout)("Call by name:\n");
+		Script::benchmark([&] { gameplay.call("public_donothing"); });
+		strf::to(stdout)("Call by function handle:\n");
+		Script::benchmark([&] { gameplay.call(donothing); });
+		// Separate event calls vs one batch
+		std::vector<Script::gaddr_t> batch(1000, 0x0);
+		Event<void(Script::gaddr_t)> batch_event(gameplay, donothing);
+		strf::to(stdout)("1000 separate event calls:\n");
+		Script::benchmark([&] { for (auto arg : batch) batch_event.call(arg); }, 10);
+		strf::to(stdout)("1000 event calls in one batch:\n");
+		Script::benchmark([&] { batch_event.call_batch(std::span(batch)); }, 10);
+		// Arguments copied onto the stack vs placed once in the argument arena
+		Event<void(const std::string&, const C&, const std::string&)> args_event(gameplay, donothing);
+		strf::to(stdout)("Event call with copied arguments:\n");
+		Script::benchmark([&] { args_event.call("Hello", C {}, "World"); });
+		const auto hello = gameplay.intern("Hello");
+		const auto world = gameplay.intern("World");
+		const auto c = gameplay.place(C {});
+		strf::to(stdout)("Event call with arena arguments:\n");
+		Script::benchmark([&] { args_event.call(hello, c, world); });
+		gameplay.reset_frame_arguments();
+		// Memory usage of clones of the same program
+		events.clone_benchmark();
+#ifndef EMBEDDED_MODE
+		// Heap-allocated vs memory-mapped program loading
+		events.load_benchmark();
+#endif
+		// Leasing pooled instances vs constructing new ones
+		events.pool_benchmark();
+		// Nested calls at depth 1, 2 and 4
+		gameplay.nested_benchmark(gameplay.address_of("nested_call"));
+#ifdef DYNCALL_PROFILING
+		// Which dynamic calls the benchmarks spent host time in
+		strf::to(stdout)(gameplay.dyncall_profile_table());
+#endif
 	}
 
 	strf::to(stdout)("...\nBringing up the main screen!\n");
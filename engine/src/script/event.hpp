@@ -1,11 +1,38 @@
 #pragma once
 #include "script.hpp"
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 
 enum EventUsagePattern : int {
 	SharedScript = 0,
 	PerThread    = 1,
 };
 
+/// @brief The number of arguments in each element of a batch,
+/// which is either a single argument or a tuple of arguments
+template <typename T> struct EventBatchArgs {
+	static constexpr bool is_tuple = false;
+	static constexpr size_t count = 1;
+	template <typename F>
+	static constexpr bool invocable = std::is_invocable_v<F, T>;
+};
+template <typename... Args> struct EventBatchArgs<std::tuple<Args...>> {
+	static constexpr bool is_tuple = true;
+	static constexpr size_t count = sizeof...(Args);
+	template <typename F>
+	static constexpr bool invocable = std::is_invocable_v<F, Args...>;
+};
+
+/// @brief Batched calls pass every argument in an integer register
+template <typename F> struct EventBatchParams {
+	static constexpr bool integral = false;
+};
+template <typename R, typename... Args> struct EventBatchParams<R(Args...)> {
+	static constexpr bool integral = ((std::is_integral_v<Args> || std::is_enum_v<Args>) && ...);
+};
+
 /// @brief Create a wrapper for a function call, matching the
 /// function type F into a given Script instance, for the given function.
 /// @tparam Usage The usage pattern of the event, either SharedScript or PerThread
@@ -14,15 +41,26 @@ template <typename F, EventUsagePattern Usage = PerThread>
 struct Event
 {
 	Event(Script&, const std::string& func);
+	Event(Script&, const ScriptFunction& func);
 	Event(Script&, Script::gaddr_t address);
 
 	/// @brief Call the function with the given arguments
 	/// @tparam Args The event function argument types
 	/// @param args The event function arguments
-	/// @return The std::optional return value of the function, unless void
+	/// @return The std::optional return value of the function, unless void.
+	/// Floats, pairs and small structs are returned as well. See: ScriptReturn
 	template <typename... Args>
 	auto call(Args&&... args);
 
+	/// @brief Call the function once for each element in the batch, while
+	/// entering the script only once. The arguments must be integral, and
+	/// return values are discarded. The records are kept for the next batch,
+	/// so repeated batches do not allocate. See: Script::batch_call()
+	/// @param batch Either one argument, or a std::tuple of arguments, per call
+	/// @return True if all the calls completed.
+	template <typename T, size_t N>
+	bool call_batch(std::span<T, N> batch);
+
 	auto& script() noexcept
 	{
 		auto* script_ptr = m_pcall.machine().template get_userdata<Script>();
@@ -46,6 +84,23 @@ struct Event
 		return m_pcall.address();
 	}
 
+	/// @brief Give calls to this event their own instruction budget,
+	/// instead of the call budget of the Script. 0 restores the default.
+	void set_budget(uint64_t budget) noexcept
+	{
+		m_budget = budget;
+	}
+	uint64_t budget() const noexcept
+	{
+		return m_budget;
+	}
+
+	/// @brief Instruction accounting for this event, in the Script it is called on.
+	auto stats() const
+	{
+		return script().call_stats(address());
+	}
+
 	// Turn address into function name (as long as it's visible)
 	auto function() const
 	{
@@ -54,6 +109,9 @@ struct Event
 
   private:
     riscv::PreparedCall<Script::MARCH, F, Script::MAX_CALL_INSTR> m_pcall;
+	uint64_t m_budget = 0;
+	/// @brief The records of the last batch, reused by the next one
+	std::vector<Script::gaddr_t> m_batch;
 };
 
 template <typename F, EventUsagePattern Usage>
@@ -70,17 +128,34 @@ inline Event<F, Usage>::Event(Script& script, const std::string& func)
 		throw std::runtime_error("Function not found: " + func);
 }
 
+template <typename F, EventUsagePattern Usage>
+inline Event<F, Usage>::Event(Script& script, const ScriptFunction& func)
+  : Event(script, script.address_of(func))
+{
+	if (address() == 0x0)
+		throw std::runtime_error("Function not found: " + std::string(func.name()));
+}
+
 template <typename F, EventUsagePattern Usage>
 template <typename... Args> inline auto Event<F, Usage>::call(Args&&... args)
 {
-	static_assert(std::is_invocable_v<F, Args...>);
-	using Ret = decltype((F*){}(args...));
+	// Interned strings and placed objects stand in for their own types
+	static_assert(std::is_invocable_v<F, guest_argument_t<Args>...>);
+	using Ret = std::invoke_result_t<F, guest_argument_t<Args>...>;
+	// Integral results are read as a signed register, and then converted
+	using R = std::conditional_t<std::is_void_v<Ret> || std::is_integral_v<Ret>,
+		Script::sgaddr_t, Ret>;
 
 	auto& script = this->script();
-	if (auto res = script.template prepared_call<F, Args&&...>(m_pcall, std::forward<Args>(args)...)) {
+	std::optional<R> res;
+	if (m_budget != 0)
+		res = script.template call_with_budget<R>(m_budget, address(), std::forward<Args>(args)...);
+	else
+		res = script.template prepared_call<F, R>(m_pcall, std::forward<Args>(args)...);
+	if (res) {
 		if constexpr (std::is_same_v<void, Ret>)
 			return true;
-		else if constexpr (std::is_same_v<Script::gaddr_t, Ret>)
+		else if constexpr (std::is_same_v<R, Ret> || std::is_same_v<Script::gaddr_t, Ret>)
 			return res;
 		else
 			return std::optional<Ret> (res.value());
@@ -90,3 +165,34 @@ template <typename... Args> inline auto Event<F, Usage>::call(Args&&... args)
 	else
 		return std::optional<Ret>{std::nullopt};
 }
+
+template <typename F, EventUsagePattern Usage>
+template <typename T, size_t N> inline bool Event<F, Usage>::call_batch(std::span<T, N> batch)
+{
+	using Element = std::remove_cv_t<T>;
+	static constexpr size_t stride = 1 + EventBatchArgs<Element>::count;
+	static_assert(stride <= 1 + Script::MAX_BATCH_ARGS, "Too many arguments to batch");
+	static_assert(EventBatchArgs<Element>::template invocable<F>,
+		"The event function cannot be called with the batched arguments");
+	static_assert(EventBatchParams<F>::integral,
+		"The event function must only take integral arguments");
+
+	auto& records = this->m_batch;
+	records.clear();
+	records.reserve(batch.size() * stride);
+	auto append = [&records] (const auto& value) {
+		using V = std::decay_t<decltype(value)>;
+		static_assert(std::is_integral_v<V> || std::is_enum_v<V>,
+			"Batched arguments must be integral");
+		records.push_back(static_cast<Script::gaddr_t>(value));
+	};
+	for (const auto& args : batch)
+	{
+		records.push_back(address());
+		if constexpr (!EventBatchArgs<Element>::is_tuple)
+			append(args);
+		else
+			std::apply([&] (const auto&... arg) { (append(arg), ...); }, args);
+	}
+	return script().batch_call(records.data(), batch.size(), stride);
+}
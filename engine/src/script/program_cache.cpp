@@ -0,0 +1,393 @@
+#include "program_cache.hpp"
+
+#include <libriscv/util/crc32.hpp>
+#include <chrono>
+#include <elf.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+using gaddr_t = Program::gaddr_t;
+static std::vector<uint8_t> load_file(const std::string& filename);
+template <typename Ehdr, typename Shdr, typename Sym>
+static void build_symbol_index(std::string_view binary,
+	std::unordered_map<std::string_view, gaddr_t, string_hash, strhash_equal>& symbols,
+	std::vector<Program::Symbol>& by_address);
+
+static int64_t file_mtime(const struct stat& st)
+{
+	return st.st_mtim.tv_sec * int64_t(1e9) + st.st_mtim.tv_nsec;
+}
+
+Program::Program(std::shared_ptr<const void> owner, std::string_view binary,
+	const std::string& filename, int64_t mtime, Storage storage)
+  : Program(std::move(owner), binary, filename, mtime, storage, hash_of(binary))
+{
+}
+
+Program::Program(std::shared_ptr<const void> owner, std::string_view binary,
+	const std::string& filename, int64_t mtime, Storage storage, uint32_t hash)
+  : m_owner(std::move(owner)), m_binary(binary), m_filename(filename),
+	m_hash(hash), m_mtime(mtime), m_storage(storage)
+{
+	if constexpr (MARCH == 4)
+		build_symbol_index<Elf32_Ehdr, Elf32_Shdr, Elf32_Sym>(m_binary, m_symbols, m_symbols_by_address);
+	else
+		build_symbol_index<Elf64_Ehdr, Elf64_Shdr, Elf64_Sym>(m_binary, m_symbols, m_symbols_by_address);
+	// Function handles look up symbols by their precomputed hash
+	for (const auto& it : m_symbols)
+	{
+		m_symbols_by_hash.emplace(ScriptFunction::hash_of(it.first),
+			Symbol {it.second, 0, it.first});
+	}
+}
+
+uint32_t Program::hash_of(std::string_view binary)
+{
+	return riscv::crc32(0x0, binary.data(), binary.size());
+}
+
+std::shared_ptr<const Program> Program::open(const std::string& filename, Storage storage)
+{
+	const auto t0 = std::chrono::steady_clock::now();
+	auto file = read_file(filename, storage);
+	auto program = std::make_shared<Program>(std::move(file.owner), file.binary,
+		filename, file.mtime, storage);
+	// Includes hashing the binary
+	program->m_load_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - t0).count();
+	return program;
+}
+
+Program::File Program::read_file(const std::string& filename, Storage storage)
+{
+	if (storage == Storage::Embedded)
+		throw std::runtime_error("Embedded programs cannot be opened: " + filename);
+	if (storage == Storage::Mapped)
+		return map_file(filename);
+
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		throw std::runtime_error("Could not open file: " + filename);
+	auto binary = std::make_shared<const std::vector<uint8_t>> (load_file(filename));
+	const std::string_view view((const char*)binary->data(), binary->size());
+	return {std::move(binary), view, file_mtime(st)};
+}
+
+Program::File Program::map_file(const std::string& filename)
+{
+	const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		throw std::runtime_error("Could not open file: " + filename);
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		throw std::runtime_error("Could not open file: " + filename);
+	}
+	const size_t size = st.st_size;
+	// The mapping outlives the file descriptor
+	void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		throw std::runtime_error("Could not map file: " + filename);
+
+	std::shared_ptr<const void> owner(data, [size] (const void* data) {
+		munmap(const_cast<void*>(data), size);
+	});
+	return {std::move(owner), std::string_view((const char*)data, size), file_mtime(st)};
+}
+
+std::shared_ptr<const Program> Program::from_binary(
+	std::shared_ptr<const std::vector<uint8_t>> binary, const std::string& filename)
+{
+	const std::string_view view((const char*)binary->data(), binary->size());
+	return std::make_shared<const Program>(std::move(binary), view, filename, 0, Storage::Heap);
+}
+
+std::shared_ptr<const Program> Program::from_embedded(
+	std::string_view blob, const std::string& filename)
+{
+	return std::make_shared<const Program>(nullptr, blob, filename, 0, Storage::Embedded);
+}
+
+void Program::validate() const
+{
+	static constexpr int ELF_CLASS = (MARCH == 4) ? ELFCLASS32 : ELFCLASS64;
+	// The identification and machine fields are at the same offsets
+	// in both the 32- and 64-bit ELF headers
+	if (m_binary.size() < sizeof(Elf32_Ehdr)
+		|| memcmp(m_binary.data(), ELFMAG, SELFMAG) != 0)
+		throw std::runtime_error(filename() + ": Not an ELF program");
+	const auto* hdr = (const Elf32_Ehdr*)m_binary.data();
+	if (hdr->e_ident[EI_CLASS] != ELF_CLASS)
+		throw std::runtime_error(filename() + ": Wrong ELF class for this engine");
+	if (hdr->e_machine != EM_RISCV)
+		throw std::runtime_error(filename() + ": Not a RISC-V ELF program");
+}
+
+gaddr_t Program::address_of(std::string_view name) const
+{
+	auto it = m_symbols.find(name);
+	if (it != m_symbols.end())
+		return it->second;
+	return 0x0;
+}
+
+gaddr_t Program::address_of(const ScriptFunction& func) const
+{
+	// Symbols never move, so a remembered symbol is valid for good
+	auto& slot = m_handle_cache[func.hash() % HANDLE_SLOTS];
+	const HashedSymbol* cached = slot.load(std::memory_order_acquire);
+	if (LIKELY(cached != nullptr && cached->first == func.hash()
+			&& cached->second.name == func.name()))
+		return cached->second.address;
+
+	auto range = m_symbols_by_hash.equal_range(func.hash());
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (LIKELY(it->second.name == func.name())) {
+			slot.store(&*it, std::memory_order_release);
+			return it->second.address;
+		}
+	}
+	return 0x0;
+}
+
+Program::Callsite Program::lookup(gaddr_t address) const
+{
+	auto it = std::upper_bound(m_symbols_by_address.begin(), m_symbols_by_address.end(),
+		address, [] (gaddr_t addr, const Symbol& sym) { return addr < sym.address; });
+	if (it == m_symbols_by_address.begin())
+		return {"(null)", 0x0, address};
+	--it;
+	return {it->name, it->address, address - it->address};
+}
+
+template <typename Ehdr, typename Shdr, typename Sym>
+static void build_symbol_index(std::string_view binary,
+	std::unordered_map<std::string_view, gaddr_t, string_hash, strhash_equal>& symbols,
+	std::vector<Program::Symbol>& by_address)
+{
+	// Dynamic executables usually have a hash lookup table for symbols,
+	// but no such thing for static executables. So, we compensate by
+	// indexing the symbol table once, for all instances of the program.
+	// Programs that are not valid ELFs simply have no symbols.
+	if (binary.size() < sizeof(Ehdr) || memcmp(binary.data(), ELFMAG, SELFMAG) != 0)
+		return;
+	const auto* hdr = (const Ehdr*)binary.data();
+	if (hdr->e_shoff == 0 || hdr->e_shoff + hdr->e_shnum * sizeof(Shdr) > binary.size())
+		return;
+	const auto* shdrs = (const Shdr*)&binary[hdr->e_shoff];
+
+	for (size_t i = 0; i < hdr->e_shnum; i++)
+	{
+		const auto& symtab = shdrs[i];
+		if (symtab.sh_type != SHT_SYMTAB || symtab.sh_link >= hdr->e_shnum)
+			continue;
+		const auto& strtab = shdrs[symtab.sh_link];
+		if (symtab.sh_offset + symtab.sh_size > binary.size()
+			|| strtab.sh_offset + strtab.sh_size > binary.size())
+			return;
+		const auto* syms = (const Sym*)&binary[symtab.sh_offset];
+		const size_t count = symtab.sh_size / sizeof(Sym);
+		const std::string_view strings(&binary[strtab.sh_offset], strtab.sh_size);
+
+		for (size_t j = 0; j < count; j++)
+		{
+			const auto& sym = syms[j];
+			// The type is in the low bits of st_info for both classes
+			const int type = ELF64_ST_TYPE(sym.st_info);
+			if (sym.st_name == 0 || sym.st_name >= strings.size() || sym.st_shndx == SHN_UNDEF)
+				continue;
+			if (type != STT_FUNC && type != STT_OBJECT && type != STT_NOTYPE)
+				continue;
+			const char* name = &strings[sym.st_name];
+			const std::string_view view(name, strnlen(name, strings.size() - sym.st_name));
+			// Skip mapping symbols and local labels
+			if (view.empty() || view[0] == '$' || view.substr(0, 2) == ".L")
+				continue;
+			// The first symbol with a given name wins
+			symbols.try_emplace(view, sym.st_value);
+			by_address.push_back({gaddr_t(sym.st_value), gaddr_t(sym.st_size), view});
+		}
+	}
+	std::stable_sort(by_address.begin(), by_address.end(),
+		[] (const Program::Symbol& a, const Program::Symbol& b) { return a.address < b.address; });
+}
+
+const Program::DyncallTable& Program::dyncall_table(const machine_t& machine) const
+{
+	std::call_once(m_dyncall_once, [&] {
+		const gaddr_t g_table = this->address_of("dyncall_table");
+		if (g_table == 0x0)
+			throw std::runtime_error(filename() + ": Unable to find dynamic call table");
+		// Table header contains the number of entries
+		const uint32_t entries = machine.memory.read<uint32_t> (g_table);
+		if (entries > 512)
+			throw std::runtime_error(filename() + ": Too many dynamic call table entries (bogus value)");
+
+		// Copy whole table (skipping past header) into vector
+		std::vector<DyncallDesc> table (entries);
+		machine.copy_from_guest(table.data(), g_table + 0x4, entries * sizeof(DyncallDesc));
+
+		m_dyncall_table.address = g_table;
+		m_dyncall_table.entries = std::move(table);
+	});
+	return m_dyncall_table;
+}
+
+std::shared_ptr<const Program::ResolvedDyncalls> Program::resolved_dyncalls(unsigned mode) const
+{
+	std::scoped_lock lock(m_resolved_mtx);
+	return m_resolved.at(mode);
+}
+
+void Program::share_resolved_dyncalls(std::shared_ptr<const ResolvedDyncalls> resolved) const
+{
+	std::scoped_lock lock(m_resolved_mtx);
+	auto& current = m_resolved.at(resolved->mode);
+	if (current == nullptr || current->epoch < resolved->epoch)
+		current = std::move(resolved);
+}
+
+std::shared_ptr<const Program> ProgramCache::load(
+	const std::string& filename, Program::Storage storage)
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		throw std::runtime_error("Could not open file: " + filename);
+
+	{
+		std::scoped_lock lock(m_mtx);
+		auto it = m_by_path.find(filename);
+		if (it != m_by_path.end() && it->second.mtime == file_mtime(st))
+			return it->second.program;
+	}
+
+	// Read and hash the file outside of the lock, as it may be slow
+	const auto t0 = std::chrono::steady_clock::now();
+	auto file = Program::read_file(filename, storage);
+	const uint32_t hash = Program::hash_of(file.binary);
+	{
+		std::scoped_lock lock(m_mtx);
+		// The same contents may already be loaded from another path
+		if (auto program = find_locked(hash, file.binary)) {
+			set_path_locked(filename, program, file.mtime);
+			return program;
+		}
+	}
+
+	// Only a new program builds its symbol index
+	auto created = std::make_shared<Program>(std::move(file.owner), file.binary,
+		filename, file.mtime, storage, hash);
+	created->m_load_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - t0).count();
+
+	std::scoped_lock lock(m_mtx);
+	auto program = insert_locked(std::move(created));
+	set_path_locked(filename, program, file.mtime);
+	return program;
+}
+
+std::shared_ptr<const Program> ProgramCache::insert(std::shared_ptr<const Program> program)
+{
+	std::scoped_lock lock(m_mtx);
+	return insert_locked(std::move(program));
+}
+
+std::shared_ptr<const Program> ProgramCache::insert(
+	std::shared_ptr<const std::vector<uint8_t>> binary, const std::string& filename)
+{
+	const std::string_view view((const char*)binary->data(), binary->size());
+	const uint32_t hash = Program::hash_of(view);
+	{
+		std::scoped_lock lock(m_mtx);
+		if (auto program = find_locked(hash, view))
+			return program;
+	}
+	auto created = std::make_shared<const Program>(
+		std::move(binary), view, filename, 0, Program::Storage::Heap, hash);
+
+	std::scoped_lock lock(m_mtx);
+	return insert_locked(std::move(created));
+}
+
+std::shared_ptr<const Program> ProgramCache::find_locked(uint32_t hash, std::string_view binary)
+{
+	// Programs with the same contents are shared, regardless of path
+	auto range = m_by_hash.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second->binary() == binary)
+			return it->second;
+	}
+	return nullptr;
+}
+
+std::shared_ptr<const Program> ProgramCache::insert_locked(std::shared_ptr<const Program> program)
+{
+	if (auto existing = find_locked(program->hash(), program->binary()))
+		return existing;
+
+	m_by_hash.emplace(program->hash(), program);
+	return program;
+}
+
+void ProgramCache::set_path_locked(const std::string& filename,
+	std::shared_ptr<const Program> program, int64_t mtime)
+{
+	auto it = m_by_path.find(filename);
+	if (it == m_by_path.end()) {
+		m_by_path.emplace(filename, PathEntry{std::move(program), mtime});
+		return;
+	}
+	auto previous = std::exchange(it->second, PathEntry{std::move(program), mtime}).program;
+	if (previous == it->second.program)
+		return;
+	// The file was replaced. Forget the previous contents, unless
+	// another path still has them. Running instances keep their program.
+	for (const auto& [path, entry] : m_by_path)
+		if (entry.program == previous)
+			return;
+	auto range = m_by_hash.equal_range(previous->hash());
+	for (auto hit = range.first; hit != range.second; ++hit)
+	{
+		if (hit->second == previous) {
+			m_by_hash.erase(hit);
+			return;
+		}
+	}
+}
+
+void ProgramCache::clear()
+{
+	std::scoped_lock lock(m_mtx);
+	m_by_path.clear();
+	m_by_hash.clear();
+}
+
+std::vector<uint8_t> load_file(const std::string& filename)
+{
+	size_t size = 0;
+	FILE* f		= fopen(filename.c_str(), "rb");
+	if (f == NULL)
+		throw std::runtime_error("Could not open file: " + filename);
+
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	std::vector<uint8_t> result(size);
+	if (size != fread(result.data(), 1, size, f))
+	{
+		fclose(f);
+		throw std::runtime_error("Error when reading from file: " + filename);
+	}
+	fclose(f);
+	return result;
+}
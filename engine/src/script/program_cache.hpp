@@ -0,0 +1,229 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <libriscv/machine.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "script_function.hpp"
+#include "string_hash.hpp"
+struct Script;
+
+/// @brief An immutable program binary, shared by every Script instance
+/// created from it, along with everything derived from the binary.
+/// The decoded execute segments are not held here. libriscv shares them
+/// between machines by their contents instead, when shared execute segments
+/// are enabled, see: Script::machine_options(). Without them, eg. with
+/// REMOTE set, every instance decodes the program again.
+struct Program
+{
+	static constexpr int MARCH = RISCV_ARCH / 8;
+	using gaddr_t	= riscv::address_type<MARCH>;
+	using machine_t = riscv::Machine<MARCH>;
+
+	/// @brief Where the program binary is stored
+	enum class Storage : uint8_t {
+		/// @brief A copy of the binary on the heap
+		Heap,
+		/// @brief A read-only memory mapping of the file
+		Mapped,
+		/// @brief A blob embedded in the executable
+		Embedded,
+	};
+
+	// An entry in the programs dynamic call table
+	struct DyncallDesc {
+		uint32_t hash;
+		uint32_t resv;
+		uint32_t strname;
+		bool initialization_only;
+		bool client_side_only;
+		bool server_side_only;
+	};
+	struct DyncallTable {
+		gaddr_t address = 0x0;
+		std::vector<DyncallDesc> entries;
+	};
+	/// @brief A resolved dynamic call handler: A plain function pointer,
+	/// and the userdata it is called with
+	struct DyncallHandler {
+		using func_t = void(*)(Script&, void* userdata);
+		func_t func;
+		void*  userdata;
+	};
+	/// @brief The host handlers for every entry of the dynamic call table,
+	/// resolved for one mode against one epoch of the dynamic call registry.
+	/// It never changes, and is shared by every instance in that mode.
+	struct ResolvedDyncalls {
+		std::vector<DyncallHandler> handlers;
+		uint64_t epoch = 0;
+		unsigned mode = 0;
+		unsigned unimplemented = 0;
+	};
+	/// @brief Initialization and client-side, see: Script::resolve_dynamic_calls()
+	static constexpr unsigned DYNCALL_MODES = 4;
+
+	/// @brief The filename the program was first loaded from.
+	const auto& filename() const noexcept { return m_filename; }
+	/// @brief The CRC32 hash of the program binary.
+	uint32_t hash() const noexcept { return m_hash; }
+	/// @brief The ELF program binary. It stays valid for the lifetime of the program.
+	std::string_view binary() const noexcept { return m_binary; }
+	/// @brief Where the program binary is stored.
+	Storage storage() const noexcept { return m_storage; }
+	/// @brief The time it took to load the program, in nanoseconds.
+	int64_t load_time() const noexcept { return m_load_time; }
+
+	/// @brief Check that the binary is a RISC-V ELF program for the
+	/// architecture of the engine, without loading it. Throws if not.
+	void validate() const;
+
+	/// @brief A symbol from the symbol table of the program
+	struct Symbol {
+		gaddr_t address;
+		gaddr_t size;
+		/// @brief Points into the program binary
+		std::string_view name;
+	};
+	/// @brief The closest symbol at or below an address
+	struct Callsite {
+		std::string_view name;
+		gaddr_t address;
+		gaddr_t offset;
+	};
+
+	/// @brief Look up the address of a name in the symbol index, which is
+	/// built once from the ELF symbol table. Returns 0x0 if not found.
+	/// @param name The name to find the virtual address for.
+	gaddr_t address_of(std::string_view name) const;
+	/// @brief Look up the address of a function handle, using its
+	/// precomputed hash. Returns 0x0 if not found. Found symbols are
+	/// remembered by the program, so that a handle can be shared by
+	/// scripts of many programs without them evicting each other.
+	gaddr_t address_of(const ScriptFunction& func) const;
+
+	/// @brief Find the closest symbol at or below an address.
+	/// @param address The virtual address to find in the symbol index.
+	Callsite lookup(gaddr_t address) const;
+
+	/// @brief The dynamic call table of the program. It is read-only, and is
+	/// read once from the first machine that asks for it.
+	/// @param machine Any machine running this program.
+	const DyncallTable& dyncall_table(const machine_t& machine) const;
+	/// @brief The most recently resolved dynamic calls for a mode, or nullptr.
+	std::shared_ptr<const ResolvedDyncalls> resolved_dyncalls(unsigned mode) const;
+	/// @brief Share resolved dynamic calls with later instances, unless
+	/// the program already has them resolved against a newer epoch.
+	void share_resolved_dyncalls(std::shared_ptr<const ResolvedDyncalls>) const;
+
+	/// @brief Open a program file without going through the cache.
+	/// A mapped file must be replaced, not rewritten in-place, while in use.
+	/// @param filename The path to the ELF program.
+	/// @param storage Heap to read the file into memory, Mapped to map it.
+	static std::shared_ptr<const Program> open(
+		const std::string& filename, Storage storage = Storage::Mapped);
+	/// @brief Create a program from a binary already in memory.
+	static std::shared_ptr<const Program> from_binary(
+		std::shared_ptr<const std::vector<uint8_t>> binary, const std::string& filename);
+	/// @brief Create a program from a blob embedded in the executable,
+	/// which must never be unloaded. See: EMBEDDED_MODE.
+	static std::shared_ptr<const Program> from_embedded(
+		std::string_view blob, const std::string& filename);
+
+	Program(std::shared_ptr<const void> owner, std::string_view binary,
+		const std::string& filename, int64_t mtime, Storage storage);
+	/// @brief Create a program whose binary has already been hashed.
+	Program(std::shared_ptr<const void> owner, std::string_view binary,
+		const std::string& filename, int64_t mtime, Storage storage, uint32_t hash);
+
+	/// @brief The CRC32 hash of a program binary, see: hash()
+	static uint32_t hash_of(std::string_view binary);
+
+  private:
+	/// @brief A program file in memory, before anything is derived from it
+	struct File {
+		std::shared_ptr<const void> owner;
+		std::string_view binary;
+		int64_t mtime;
+	};
+	static File read_file(const std::string& filename, Storage storage);
+	static File map_file(const std::string& filename);
+
+	/// @brief Keeps the storage behind the binary alive, if it needs to be
+	const std::shared_ptr<const void> m_owner;
+	const std::string_view m_binary;
+	const std::string m_filename;
+	const uint32_t m_hash;
+	const int64_t m_mtime;
+	const Storage m_storage;
+	int64_t m_load_time = 0;
+
+	/// @brief The symbol index never changes after construction,
+	/// and lookups can be made from any thread without locking.
+	std::unordered_map<std::string_view, gaddr_t, string_hash, strhash_equal> m_symbols;
+	std::unordered_multimap<uint32_t, Symbol> m_symbols_by_hash;
+	/// @brief Functions and objects, sorted by address
+	std::vector<Symbol> m_symbols_by_address;
+	/// @brief Symbols found by function handles, indexed by the low bits
+	/// of the handles hash. Only written when a slot is empty or collides.
+	static constexpr size_t HANDLE_SLOTS = 256;
+	using HashedSymbol = std::pair<const uint32_t, Symbol>;
+	mutable std::array<std::atomic<const HashedSymbol*>, HANDLE_SLOTS> m_handle_cache {};
+
+	mutable std::once_flag m_dyncall_once;
+	mutable DyncallTable m_dyncall_table;
+	mutable std::mutex m_resolved_mtx;
+	mutable std::array<std::shared_ptr<const ResolvedDyncalls>, DYNCALL_MODES> m_resolved;
+
+	friend struct ProgramCache;
+};
+
+/// @brief A process-wide cache of programs, so that the second and later
+/// instances of a program skip loading, hashing and parsing entirely.
+/// Decoding is skipped through libriscv's shared execute segments.
+struct ProgramCache
+{
+	/// @brief Load a program from a file. The cached program is returned
+	/// as long as the file has not been modified since it was loaded.
+	/// @param filename The path to the ELF program.
+	/// @param storage How to store the program, if it is not cached.
+	/// @return The shared program.
+	static std::shared_ptr<const Program> load(const std::string& filename,
+		Program::Storage storage = Program::Storage::Mapped);
+
+	/// @brief Find a cached program with the same contents as the given
+	/// program, or insert it as a new program.
+	/// @param program The new program.
+	/// @return The shared program.
+	static std::shared_ptr<const Program> insert(std::shared_ptr<const Program> program);
+	/// @brief Find a cached program with the same contents as the binary,
+	/// or create and insert a new program from it. Only the hash of the
+	/// binary is computed when the program is already cached.
+	/// @param binary The ELF program binary.
+	/// @param filename The filename of the new program.
+	/// @return The shared program.
+	static std::shared_ptr<const Program> insert(
+		std::shared_ptr<const std::vector<uint8_t>> binary, const std::string& filename);
+
+	/// @brief Forget all cached programs. Existing instances are unaffected.
+	static void clear();
+
+  private:
+	static std::shared_ptr<const Program> find_locked(uint32_t hash, std::string_view binary);
+	static std::shared_ptr<const Program> insert_locked(std::shared_ptr<const Program> program);
+	static void set_path_locked(const std::string& filename,
+		std::shared_ptr<const Program> program, int64_t mtime);
+
+	struct PathEntry {
+		std::shared_ptr<const Program> program;
+		/// @brief The modification time of the file, when it was loaded
+		int64_t mtime;
+	};
+	static inline std::mutex m_mtx;
+	static inline std::unordered_map<std::string, PathEntry> m_by_path;
+	static inline std::unordered_multimap<uint32_t, std::shared_ptr<const Program>> m_by_hash;
+};
@@ -1,14 +1,18 @@
 #include "script.hpp"
+#include "script_faults.hpp"
 using gaddr_t = Script::gaddr_t;
 
 #include "../../api/api_structs.h"
 #include "../../api/syscalls.h"
+#include <chrono>
+#include <cstring>
 #include <fstream> // Windows doesn't implement C getline()
 #include <libriscv/native_heap.hpp>
 #include <libriscv/threads.hpp>
 #include <libriscv/util/crc32.hpp>
+#include <mutex>
 #include <strf/to_cfile.hpp>
-static std::vector<uint8_t> load_file(const std::string& filename);
+#include <strf/to_string.hpp>
 // Some dynamic calls are currently enabled late in initialization
 static constexpr bool WARN_ON_UNIMPLEMENTED_DYNCALL = false;
 /// @brief The shared memory area is 8KB and read+write
@@ -24,77 +28,148 @@ static const std::vector<std::string> env = {
 };
 using riscv::crc32;
 
+// Returns the time since t0, and restarts the clock
+static int64_t nanos_since(std::chrono::steady_clock::time_point& t0)
+{
+	const auto t1 = std::chrono::steady_clock::now();
+	const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+	t0 = t1;
+	return ns;
+}
+
 Script::Script(
-	std::shared_ptr<const std::vector<uint8_t>> binary, const std::string& name,
-	const std::string& filename, bool debug, void* userptr)
-  : m_binary(binary),
+	std::shared_ptr<const Program> program, const std::string& name,
+	const std::string& filename, bool debug, void* userptr, BootMode boot)
+  : m_program(std::move(program)),
     m_userptr(userptr), m_name(name),
 	m_filename(filename), m_hash(crc32(name.c_str(), name.size())), m_is_debug(debug)
 {
-	static bool init = false;
-	if (!init)
-	{
-		init = true;
-		Script::setup_syscall_interface();
-	}
-	this->reset();
-	this->initialize();
+	// Scripts may be constructed concurrently, see: ScriptLoader
+	static std::once_flag init;
+	std::call_once(init, Script::setup_syscall_interface);
 
-	if (machine().is_binary_translation_enabled())
+	if (boot == BootMode::Deferred)
 	{
-		strf::to(stdout)(">>> ", name, ": Binary translation enabled\n");
+		// Fail early on programs that could never boot
+		m_program->validate();
+		return;
 	}
+	this->boot();
 }
 
 Script::Script(
-	const std::string& name, const std::string& filename, bool debug, void* userptr)
-  : Script(std::make_shared<const std::vector<uint8_t>> (load_file(filename)), name, filename, debug, userptr)
+	std::shared_ptr<const std::vector<uint8_t>> binary, const std::string& name,
+	const std::string& filename, bool debug, void* userptr, BootMode boot)
+  : Script(ProgramCache::insert(std::move(binary), filename),
+	name, filename, debug, userptr, boot)
+{}
+
+Script::Script(
+	const std::string& name, const std::string& filename, bool debug,
+	void* userptr, BootMode boot)
+  : Script(ProgramCache::load(filename), name, filename, debug, userptr, boot)
 {}
 
-Script Script::clone(const std::string& name, void* userptr)
+Script Script::clone(const std::string& name, void* userptr, CloneMode mode)
 {
-	return Script(this->m_binary, name, this->m_filename, this->m_is_debug, userptr);
+	// Forking the latest snapshot avoids running through initialization again
+	if (this->m_snapshot != nullptr)
+		return Script(this->m_snapshot, name, userptr, mode);
+	if (mode == CloneMode::CopyOnWrite)
+		throw std::runtime_error(name + ": Copy-on-write clones require a snapshot");
+	return Script(this->m_program, name, this->m_filename, this->m_is_debug, userptr);
 }
 
 Script::~Script() {}
 
+riscv::MachineOptions<Script::MARCH> Script::machine_options() const
+{
+	return riscv::MachineOptions<MARCH> {
+		.memory_max		  = MAX_MEMORY,
+		.stack_size		  = STACK_SIZE,
+		.verbose_loader   = getenv("VERBOSE") != nullptr,
+		// Copy-on-write clones access all memory through pages
+		.use_memory_arena = m_cow_source == nullptr,
+		.use_shared_execute_segments = getenv("REMOTE") == nullptr, // Remote calls don't work with shared segments
+		.default_exit_function = "fast_exit",
+#ifdef RISCV_BINARY_TRANSLATION
+		.translate_enabled = getenv("NO_TRANSLATE") == nullptr,
+		// The gameplay machine is loaded into a high-memory area
+		// In order for remote calls to work, disable the arena
+		.translation_use_arena = name() != "gameplay" && m_cow_source == nullptr,
+		.translate_use_register_caching = false,
+#endif
+	};
+}
+
+void Script::boot()
+{
+	try
+	{
+		this->reset();
+		this->initialize();
+	}
+	catch (...)
+	{
+		// Leave a deferred instance able to retry booting
+		m_machine = nullptr;
+		throw;
+	}
+
+	m_startup.load_file = m_program->load_time();
+	m_startup.binary_translated = machine().is_binary_translation_enabled();
+	if (machine().is_binary_translation_enabled())
+	{
+		strf::to(Script::output())(">>> ", name(), ": Binary translation enabled\n");
+	}
+}
+
 void Script::reset()
 {
 	// If the reset fails, this object is still valid:
 	// m_machine.reset() will not happen if new machine_t fails
 	try
 	{
-		// Create a new machine based on m_binary */
-		riscv::MachineOptions<MARCH> options {
-			.memory_max		  = MAX_MEMORY,
-			.stack_size		  = STACK_SIZE,
-			.verbose_loader   = getenv("VERBOSE") != nullptr,
-			.use_memory_arena = true,
-			.use_shared_execute_segments = getenv("REMOTE") == nullptr, // Remote calls don't work with shared segments
-			.default_exit_function = "fast_exit",
-#ifdef RISCV_BINARY_TRANSLATION
-			.translate_enabled = getenv("NO_TRANSLATE") == nullptr,
-			// The gameplay machine is loaded into a high-memory area
-			// In order for remote calls to work, disable the arena
-			.translation_use_arena = name() != "gameplay",
-			.translate_use_register_caching = false,
-#endif
-		};
-		m_machine = std::make_unique<machine_t> (*m_binary, options);
+		auto t0 = std::chrono::steady_clock::now();
+		// Create a new machine based on the shared program
+		m_machine = std::make_unique<machine_t> (m_program->binary(), machine_options());
+		m_startup.construct = nanos_since(t0);
 
 		// setup system calls and traps
 		this->machine_setup();
+		m_startup.machine_setup = nanos_since(t0);
+
+		// Figure out the local indices based on dynamic call table
+		// We are pretending to be initializing the client-side
+		this->resolve_dynamic_calls(true, true, false);
+		m_startup.resolve_dynamic_calls = nanos_since(t0);
+
 		// setup program argv *after* setting new stack pointer
 		machine().setup_linux({name()}, env);
+		m_startup.setup_linux = nanos_since(t0);
 	}
 	catch (std::exception& e)
 	{
-		strf::to(stdout)(
+		strf::to(Script::output())(
 			">>> Exception during initialization: ", e.what(), "\n");
 		throw;
 	}
 }
 
+std::string Script::startup_report() const
+{
+	const auto& t = this->m_startup;
+	return strf::to_string(
+		"{\"name\": \"", name(), "\", \"filename\": \"", filename(), "\", ",
+		"\"binary_translated\": ", t.binary_translated ? "true" : "false", ", ",
+		"\"load_file\": ", t.load_file, ", ",
+		"\"construct\": ", t.construct, ", ",
+		"\"machine_setup\": ", t.machine_setup, ", ",
+		"\"resolve_dynamic_calls\": ", t.resolve_dynamic_calls, ", ",
+		"\"setup_linux\": ", t.setup_linux, ", ",
+		"\"simulate\": ", t.simulate, "}");
+}
+
 void Script::add_shared_memory()
 {
 	auto& mem			  = machine().memory;
@@ -109,6 +184,8 @@ void Script::add_shared_memory()
 	main_thread->stack_base = stack_base;
 
 	// Shared memory area between all programs
+	// Forked machines inherit the area as copy-on-write pages, so replace them.
+	mem.free_pages(SHM_BASE, SHM_SIZE);
 	mem.insert_non_owned_memory(SHM_BASE, &shared_memory[0], SHM_SIZE);
 }
 
@@ -117,18 +194,20 @@ void Script::initialize()
 	// run through the initialization
 	try
 	{
-		machine().simulate(MAX_BOOT_INSTR);
+		auto t0 = std::chrono::steady_clock::now();
+		machine().simulate(m_boot_budget);
+		m_startup.simulate = nanos_since(t0);
 	}
 	catch (riscv::MachineTimeoutException& me)
 	{
-		strf::to(stdout)(
+		strf::to(Script::output())(
 			">>> Exception: Instruction limit reached on ", name(), "\n",
 			"Instruction count: ", machine().max_instructions(), "\n");
 		throw;
 	}
 	catch (riscv::MachineException& me)
 	{
-		strf::to(stdout)(
+		strf::to(Script::output())(
 			">>> Machine exception ", me.type(), ": ", me.what(),
 			" (data: ", strf::hex(me.data()), "\n");
 		// Remote debugging with DEBUG=1 ./engine
@@ -138,116 +217,161 @@ void Script::initialize()
 	}
 	catch (std::exception& e)
 	{
-		strf::to(stdout)(">>> Exception: ", e.what(), "\n");
+		strf::to(Script::output())(">>> Exception: ", e.what(), "\n");
 		throw;
 	}
 
-	strf::to(stdout)(">>> ", name(), " initialized.\n");
+	strf::to(Script::output())(">>> ", name(), " initialized.\n");
 }
 
 void Script::machine_setup()
+{
+	this->machine_instance_setup();
+
+	// Allocate heap area using mmap
+	this->m_heap_area = machine().memory.mmap_allocate(MAX_HEAP);
+
+	{
+		// The system call handler table is shared by all machines
+		static std::mutex syscall_mtx;
+		std::scoped_lock lock(syscall_mtx);
+		// Add POSIX system call interfaces (no filesystem or network access)
+		machine().setup_linux_syscalls(false, false);
+		machine().setup_posix_threads();
+		// Add native system call interfaces
+		machine().setup_native_heap(HEAP_SYSCALLS_BASE, heap_area(), MAX_HEAP);
+		machine().setup_native_memory(MEMORY_SYSCALLS_BASE);
+		machine().setup_native_threads(THREADS_SYSCALL_BASE);
+	}
+
+	// Remote communication
+	this->machine_remote_setup();
+
+	// Install shared memory area and guard pages
+	this->add_shared_memory();
+}
+
+void Script::machine_instance_setup()
 {
 	machine().set_userdata<Script>(this);
 	machine().set_printer((machine_t::printer_func)[](
 		const machine_t&, const char* p, size_t len) {
-		strf::to(stdout)(std::string_view {p, len});
+		strf::to(Script::output())(std::string_view {p, len});
 	});
 	machine().set_debug_printer(machine().get_printer());
 	machine().on_unhandled_csr = [](machine_t& machine, int csr, int, int)
 	{
 		auto& script = *machine.template get_userdata<Script>();
-		strf::to(stdout)(script.name(), ": Unhandled CSR: ", csr, "\n");
+		strf::to(Script::output())(script.name(), ": Unhandled CSR: ", csr, "\n");
 	};
 	machine().on_unhandled_syscall = [](machine_t& machine, size_t num)
 	{
 		auto& script = *machine.get_userdata<Script>();
-		strf::to(stdout)(script.name(), ": Unhandled system call: ", num, "\n");
+		strf::to(Script::output())(script.name(), ": Unhandled system call: ", num, "\n");
 	};
-	// Allocate heap area using mmap
-	this->m_heap_area = machine().memory.mmap_allocate(MAX_HEAP);
-
-	// Add POSIX system call interfaces (no filesystem or network access)
-	machine().setup_linux_syscalls(false, false);
-	machine().setup_posix_threads();
-	// Add native system call interfaces
-	machine().setup_native_heap(HEAP_SYSCALLS_BASE, heap_area(), MAX_HEAP);
-	machine().setup_native_memory(MEMORY_SYSCALLS_BASE);
-	machine().setup_native_threads(THREADS_SYSCALL_BASE);
-
-	// Remote communication
-	this->machine_remote_setup();
-
-	// Install shared memory area and guard pages
-	this->add_shared_memory();
-
-	// Figure out the local indices based on dynamic call table
-	// We are pretending to be initializing the client-side
-	this->resolve_dynamic_calls(true, true, false);
 }
 
 void Script::could_not_find(std::string_view func)
 {
-	strf::to(stdout)(
+	strf::to(Script::output())(
 		"Script::call(): Could not find: '", func, "' in '", name(), "'\n");
 }
 
-void Script::handle_exception(gaddr_t address)
+void Script::handle_exception(gaddr_t address, const std::exception& e)
 {
-	auto callsite = machine().memory.lookup(address);
-	strf::to(stdout)(
-		"[", name(), "] Exception when calling:\n  ", callsite.name, " (0x",
-		strf::hex(callsite.address), ")\n", "Backtrace:\n");
-	this->print_backtrace(address);
-
-	try
-	{
-		throw; // re-throw
-	}
-	catch (const riscv::MachineTimeoutException& e)
+	if (m_fault_log != nullptr)
 	{
-		this->handle_timeout(address);
-		return; // NOTE: might wanna stay
+		// Deferred: Symbolization and printing happens in the fault log
+		this->record_fault(address, e);
+		if (dynamic_cast<const riscv::MachineTimeoutException*>(&e) != nullptr)
+		{
+			this->handle_timeout(address);
+			return;
+		}
 	}
-	catch (const riscv::MachineException& e)
+	else
 	{
-		strf::to(stdout)(
-			"\nException: ", e.what(), "  (data: ", strf::hex(e.data()), ")\n",
-			">>> ", machine().cpu.current_instruction_to_string(), "\n",
-			">>> Machine registers:\n[PC\t", strf::hex(machine().cpu.pc()) > 8,
-			"] ", machine().cpu.registers().to_string(), "\n");
+		auto callsite = m_program->lookup(address);
+		strf::to(Script::output())(
+			"[", name(), "] Exception when calling:\n  ", callsite.name, " (0x",
+			strf::hex(callsite.address), ")\n", "Backtrace:\n");
+		this->print_backtrace(address);
 
-		// Remote debugging with DEBUG=1 ./engine
-		if (getenv("DEBUG"))
-			gdb_remote_debugging("", false);
+		try
+		{
+			throw; // re-throw
+		}
+		catch (const riscv::MachineTimeoutException& e)
+		{
+			this->handle_timeout(address);
+			return; // NOTE: might wanna stay
+		}
+		catch (const riscv::MachineException& e)
+		{
+			strf::to(Script::output())(
+				"\nException: ", e.what(), "  (data: ", strf::hex(e.data()), ")\n",
+				">>> ", machine().cpu.current_instruction_to_string(), "\n",
+				">>> Machine registers:\n[PC\t", strf::hex(machine().cpu.pc()) > 8,
+				"] ", machine().cpu.registers().to_string(), "\n");
+
+			// Remote debugging with DEBUG=1 ./engine
+			if (getenv("DEBUG"))
+				gdb_remote_debugging("", false);
+		}
+		catch (const std::exception& e)
+		{
+			strf::to(Script::output())("\nMessage: ", e.what(), "\n\n");
+		}
+		strf::to(Script::output())(
+			"Program page: ", machine().memory.get_page_info(machine().cpu.pc()),
+			"\n");
+		strf::to(Script::output())(
+			"Stack page: ", machine().memory.get_page_info(machine().cpu.reg(2)),
+			"\n");
 	}
-	catch (const std::exception& e)
-	{
-		strf::to(stdout)("\nMessage: ", e.what(), "\n\n");
-	}
-	strf::to(stdout)(
-		"Program page: ", machine().memory.get_page_info(machine().cpu.pc()),
-		"\n");
-	strf::to(stdout)(
-		"Stack page: ", machine().memory.get_page_info(machine().cpu.reg(2)),
-		"\n");
 	// Close active non-main thread (XXX: Probably not what we want)
 	auto& mt = machine().threads();
 	while (mt.get_tid() != 0)
 	{
 		auto* thread = mt.get_thread();
-		strf::to(stdout)(
-			"Script::call: Closing running thread: ", thread->tid, "\n");
+		if (m_fault_log == nullptr)
+			strf::to(Script::output())(
+				"Script::call: Closing running thread: ", thread->tid, "\n");
 		thread->exit();
 	}
 }
 
+void Script::record_fault(gaddr_t address, const std::exception& e)
+{
+	FaultRecord record;
+	if (auto* me = dynamic_cast<const riscv::MachineException*>(&e))
+	{
+		record.type = (dynamic_cast<const riscv::MachineTimeoutException*>(&e) != nullptr)
+			? FaultRecord::Type::Timeout : FaultRecord::Type::Machine;
+		record.exception_type = me->type();
+		record.data = me->data();
+	}
+	record.script_hash = m_hash;
+	record.address = address;
+	record.pc = machine().cpu.pc();
+	record.ra = machine().cpu.reg(riscv::REG_RA);
+	record.program = m_program;
+	m_name.copy(record.script_name, sizeof(record.script_name) - 1);
+	std::strncpy(record.message, e.what(), sizeof(record.message) - 1);
+	m_fault_log->record(record);
+}
+
 void Script::handle_timeout(gaddr_t address)
 {
 	this->m_budget_overruns++;
-	auto callsite = machine().memory.lookup(address);
-	strf::to(stdout)(
-		"Script::call: Max instructions for: ", callsite.name,
-		" (Overruns: ", m_budget_overruns, "\n");
+	this->m_call_stats[address].overruns++;
+	if (m_fault_log == nullptr)
+	{
+		auto callsite = m_program->lookup(address);
+		strf::to(Script::output())(
+			"Script::call: Max instructions for: ", callsite.name,
+			" (Overruns: ", m_budget_overruns, "\n");
+	}
 	// Check if we need to suspend a thread
 	auto& mt	 = machine().threads();
 	auto* thread = mt.get_thread();
@@ -267,9 +391,17 @@ void Script::handle_timeout(gaddr_t address)
 	}
 }
 
+Script::CallStats Script::call_stats(gaddr_t address) const
+{
+	auto it = m_call_stats.find(address);
+	if (it != m_call_stats.end())
+		return it->second;
+	return {};
+}
+
 void Script::max_depth_exceeded(gaddr_t address)
 {
-	auto callsite = machine().memory.lookup(address);
+	auto callsite = m_program->lookup(address);
 	strf::to(stderr)(
 		"Script::call(): Max call depth exceeded when calling: ", callsite.name,
 		" (0x", strf::hex(callsite.address), ")\n");
@@ -277,13 +409,18 @@ void Script::max_depth_exceeded(gaddr_t address)
 
 void Script::print_backtrace(const gaddr_t addr)
 {
-	machine().memory.print_backtrace(
-		[](std::string_view line)
-		{
-			strf::to(stdout)("-> ", line, "\n");
-		});
-	auto origin = machine().memory.lookup(addr);
-	strf::to(stdout)(
+	// Without frame pointers, only the current function and
+	// the return address are known
+	const gaddr_t frames[] = {machine().cpu.pc(), machine().cpu.reg(riscv::REG_RA)};
+	for (size_t i = 0; i < std::size(frames); i++)
+	{
+		auto frame = m_program->lookup(frames[i]);
+		strf::to(Script::output())(
+			"-> [", i, "] ", strf::hex(frame.address), " + ", strf::hex(frame.offset),
+			": ", frame.name, "\n");
+	}
+	auto origin = m_program->lookup(addr);
+	strf::to(Script::output())(
 		"-> [-] ", strf::hex(origin.address), " + ", strf::hex(origin.offset),
 		": ", origin.name, "\n");
 }
@@ -292,34 +429,23 @@ void Script::print(std::string_view text)
 {
 	if (this->m_last_newline)
 	{
-		strf::to(stdout)("[", name(), "] says: ", text);
+		strf::to(Script::output())("[", name(), "] says: ", text);
 	}
 	else
 	{
-		strf::to(stdout)(text);
+		strf::to(Script::output())(text);
 	}
 	this->m_last_newline = (text.back() == '\n');
 }
 
-gaddr_t Script::address_of(const std::string& name) const
+gaddr_t Script::address_of(std::string_view name) const
 {
-	// We need to cache lookups because they are fairly expensive
-	// Dynamic executables usually have a hash lookup table for symbols,
-	// but no such thing for static executables. So, we compensate by
-	// storing symbols in a local cache in order to reduce latencies.
-	auto it = m_lookup_cache.find(name);
-	if (it != m_lookup_cache.end())
-		return it->second;
-
-	const auto addr = machine().address_of(name.c_str());
-	m_lookup_cache.try_emplace(name, addr);
-	return addr;
+	return m_program->address_of(name);
 }
 
 std::string Script::symbol_name(gaddr_t address) const
 {
-	auto callsite = machine().memory.lookup(address);
-	return callsite.name;
+	return std::string(m_program->lookup(address).name);
 }
 
 static std::string single_spaced_string(std::string line)
@@ -340,34 +466,63 @@ void Script::set_dynamic_call(const std::string& def, ghandler_t handler)
 
 void Script::set_dynamic_call(std::string name, std::string def, ghandler_t handler)
 {
-	// Allow unsetting a dynamic call by using an uncallable/invalid callback function
+	// Allow unsetting a dynamic call by using an empty callback function,
+	// which leaves it unresolved until it is registered again
 	if (handler == nullptr) {
-		handler = [] (auto&) {
-			throw std::runtime_error("Unimplemented-trap");
-		};
+		register_dynamic_call(std::move(name), std::move(def), nullptr,
+			DyncallHandler{nullptr, nullptr});
+		return;
 	}
+	// The handler calls the std::function owned by the registry entry
+	register_dynamic_call(std::move(name), std::move(def), std::move(handler),
+		DyncallHandler{&Script::call_dyncall_function, nullptr});
+}
+
+void Script::call_dyncall_function(Script& script, void* func)
+{
+	(*static_cast<ghandler_t*>(func))(script);
+}
+
+void Script::set_dynamic_call(std::string name, std::string def,
+	DyncallHandler::func_t func, void* userdata)
+{
+	// Handlers resolved before this one may still go through the entry
+	const DyncallHandler handler {func, userdata};
+	register_dynamic_call(std::move(name), std::move(def),
+		[handler] (Script& script) { handler.func(script, handler.userdata); },
+		handler);
+}
 
+void Script::register_dynamic_call(std::string name, std::string def,
+	ghandler_t func, DyncallHandler handler)
+{
 	// Turn definition into a single-spaced string
 	def = single_spaced_string(def);
 	// Calculate hash from definition
 	const uint32_t hash = crc32(def.c_str(), def.size());
-	auto it				= m_dynamic_functions.find(hash);
-	if (it != m_dynamic_functions.end())
-	{
-		if (it->second.name != name) {
-			strf::to(stdout)(
-				"Dynamic function '", name, "' with hash ", strf::hex(hash),
-				" already exists with another name '", it->second.name, "'\n");
-			throw std::runtime_error(
-				"Script::set_dynamic_call failed: Hash collision for " + name);
-		}
-		it->second.func = std::move(handler);
-	} else {
-		m_dynamic_functions.emplace(
-			std::piecewise_construct,
-			std::forward_as_tuple(hash),
-			std::forward_as_tuple(std::move(name), std::move(def), std::move(handler)));
-	}
+	register_dynamic_call(hash, std::move(name), std::move(def),
+		std::move(func), handler);
+}
+
+void Script::register_dynamic_call(uint32_t hash, std::string name, std::string def,
+	ghandler_t func, DyncallHandler handler)
+{
+	m_dynamic_functions.update(hash,
+		[&] (const HostDyncall* current) {
+			if (current != nullptr && current->name != name) {
+				strf::to(Script::output())(
+					"Dynamic function '", name, "' with hash ", strf::hex(hash),
+					" already exists with another name '", current->name, "'\n");
+				throw std::runtime_error(
+					"Script::set_dynamic_call failed: Hash collision for " + name);
+			}
+			auto entry = std::make_unique<HostDyncall>(
+				std::move(name), std::move(def), std::move(func), handler);
+			// Entries are never moved, so the handler can point at its callback
+			if (handler.func == &Script::call_dyncall_function)
+				entry->handler.userdata = &entry->func;
+			return entry;
+		});
 }
 
 void Script::set_dynamic_calls(
@@ -381,15 +536,22 @@ void Script::set_dynamic_calls(
 
 void Script::dynamic_call_hash(uint32_t hash, gaddr_t straddr)
 {
-	auto it = m_dynamic_functions.find(hash);
-	if (LIKELY(it != m_dynamic_functions.end()))
+	const auto* entry = m_dynamic_functions.find(hash);
+	if (LIKELY(entry != nullptr && entry->handler.func != nullptr))
 	{
-		it->second.func(*this);
+#ifdef DYNCALL_PROFILING
+		auto t0 = std::chrono::steady_clock::now();
+#endif
+		const auto& handler = entry->handler;
+		handler.func(*this, handler.userdata);
+#ifdef DYNCALL_PROFILING
+		m_dyncall_profile.add_hash(hash, nanos_since(t0));
+#endif
 	}
 	else
 	{
 		auto name = machine().memory.memstring(straddr);
-		strf::to(stdout)(
+		strf::to(Script::output())(
 			"Unable to find dynamic function '", name, "' with hash ",
 			strf::hex(hash), "\n");
 		throw std::runtime_error("Unable to find dynamic function: " + name);
@@ -398,134 +560,214 @@ void Script::dynamic_call_hash(uint32_t hash, gaddr_t straddr)
 
 void Script::dynamic_call_array(uint32_t idx)
 {
-	while (true) {
-		try {
-			this->m_dyncall_array.at(idx)(*this);
+#ifdef DYNCALL_PROFILING
+	auto t0 = std::chrono::steady_clock::now();
+#endif
+	try {
+		if (UNLIKELY(idx >= m_dyncall_array.size()))
+			throw std::out_of_range("Dynamic call table index out of range");
+		const auto& handler = m_dyncall_array[idx];
+		handler.func(*this, handler.userdata);
+	} catch (const std::exception& e) {
+		// Report which dynamic call failed, and re-throw
+		this->dynamic_call_error(idx, e);
+	}
+#ifdef DYNCALL_PROFILING
+	m_dyncall_profile.add_index(idx, nanos_since(t0));
+#endif
+}
+
+void Script::unresolved_dyncall(Script& script, void* userdata)
+{
+	const auto idx = uint32_t(uintptr_t(userdata));
+	// Handlers registered since the table was resolved
+	// are looked up for the unresolved entries
+	if (script.refresh_dynamic_calls())
+	{
+		const auto& handler = script.m_dyncall_array[idx];
+		if (handler.func != &Script::unresolved_dyncall) {
+			handler.func(script, handler.userdata);
 			return;
-		} catch (const std::exception& e) {
-			// This will re-throw unless a new dynamic call is discovered
-			this->dynamic_call_error(idx, e);
 		}
 	}
+	throw std::runtime_error("Unimplemented dynamic call triggered");
 }
 
 void Script::dynamic_call_error(uint32_t idx, const std::exception& e)
 {
-	const uint32_t entries = machine().memory.read<uint32_t> (m_g_dyncall_table);
-	if (idx < entries) {
-		DyncallDesc entry;
-		const auto offset = 0x4 + idx * sizeof(DyncallDesc);
-		machine().copy_from_guest(&entry, m_g_dyncall_table + offset, sizeof(DyncallDesc));
-
-		// Try to resolve it again
-		if (e.what() == std::string("Unimplemented-trap"))
-		{
-			auto it = m_dynamic_functions.find(entry.hash);
-			if (LIKELY(it != m_dynamic_functions.end()))
-			{
-				// Resolved, return directly
-				this->m_dyncall_array.at(idx) = it->second.func;
-				return;
-			}
-			const auto dname = machine().memory.memstring(entry.strname);
-			strf::to(stdout)(
-				"ERROR: Exception in '", this->name(),"', dynamic function '", dname, "' with hash ",
-				strf::hex(entry.hash), " and table index ", idx, "\n"
+	const auto& table = m_program->dyncall_table(machine()).entries;
+	if (idx < table.size()) {
+		const auto& entry = table[idx];
+		const auto dname = machine().memory.memstring(entry.strname);
+		strf::to(Script::output())(
+			"ERROR: Exception in '", this->name(),"', dynamic function '", dname, "' with hash ",
+			strf::hex(entry.hash), " and table index ", idx, "\n");
+		if (m_dyncall_array[idx].func == &Script::unresolved_dyncall)
+			strf::to(Script::output())(
 				"ERROR: Not installed in the host game engine. Forgot to call set_dynamic_handler(...)?\n");
-		} else {
-			const auto dname = machine().memory.memstring(entry.strname);
-			strf::to(stdout)(
-				"ERROR: Exception in '", this->name(),"', dynamic function '", dname, "' with hash ",
-				strf::hex(entry.hash), " and table index ", idx, "\n");
-		}
-
 	} else {
-		strf::to(stdout)(
+		strf::to(Script::output())(
 			"ERROR: Exception in '", this->name(),"', dynamic function table index ",
 			idx, " out of range\n");
 	}
-	fflush(stdout);
+	fflush(Script::output());
 	throw;
 }
 
 void Script::resolve_dynamic_calls(bool initialization, bool client_side, bool verbose)
 {
-	this->m_g_dyncall_table = machine().address_of("dyncall_table");
-	if (m_g_dyncall_table == 0x0)
-		throw std::runtime_error(this->name() + ": Unable to find dynamic call table");
-	// Table header contains the number of entries
-	const uint32_t entries = machine().memory.read<uint32_t> (m_g_dyncall_table);
-	if (entries > 512)
-		throw std::runtime_error(this->name() + ": Too many dynamic call table entries (bogus value)");
-	// Skip past header
-	const auto g_table = m_g_dyncall_table + 0x4;
-
-	// Reserve space for host-side dynamic call handlers
-	this->m_dyncall_array.reserve(entries);
-	this->m_dyncall_array.clear();
-	unsigned unimplemented = 0;
-
-	// Copy whole table into vector
-	std::vector<DyncallDesc> table (entries);
-	machine().copy_from_guest(table.data(), g_table, entries * sizeof(DyncallDesc));
+	// The table is read-only, so it is only parsed once per program
+	const auto& dyncall_table = m_program->dyncall_table(machine());
+	this->m_g_dyncall_table = dyncall_table.address;
+	const auto& table = dyncall_table.entries;
+	const uint32_t entries = table.size();
+
+	// The handlers are resolved once per program and mode, and shared with
+	// new instances until another dynamic call is registered. Instances keep
+	// the handlers they resolved, and only resolve their unresolved entries
+	// again when they call one. See: refresh_dynamic_calls()
+	// The epoch is read first, so that a registration made while resolving
+	// causes another refresh.
+	const unsigned mode = unsigned(initialization) | (unsigned(client_side) << 1);
+	const uint64_t epoch = m_dynamic_functions.epoch();
+	auto shared = m_program->resolved_dyncalls(mode);
+	if (shared != nullptr && shared->epoch == epoch) {
+		this->use_dynamic_calls(std::move(shared));
+		return;
+	}
+
+	auto resolved = std::make_shared<Program::ResolvedDyncalls>();
+	resolved->epoch = epoch;
+	resolved->mode  = mode;
+	auto& handlers = resolved->handlers;
+	handlers.reserve(entries);
 
 	for (unsigned i = 0; i < entries; i++) {
 		auto& entry = table.at(i);
 		if (entry.initialization_only && !initialization) {
-			if (verbose) strf::to(stdout)(
+			if (verbose) strf::to(Script::output())(
 				"Skipping initialization-only dynamic call '",
 				this->machine().memory.memstring(entry.strname), "'\n");
-			this->m_dyncall_array.push_back(
-			[] (auto&) {
+			handlers.push_back({
+			[] (Script&, void*) {
 				throw std::runtime_error("Initialization-only dynamic call triggered");
-			});
+			}, nullptr});
 			continue;
 		}
 		if (entry.client_side_only && !client_side) {
-			if (verbose) strf::to(stdout)(
+			if (verbose) strf::to(Script::output())(
 				"Skipping client-side-only dynamic call '",
 				machine().memory.memstring(entry.strname), "'\n");
-			this->m_dyncall_array.push_back(
-			[] (auto&) {
+			handlers.push_back({
+			[] (Script&, void*) {
 				throw std::runtime_error("Clientside-only dynamic call triggered");
-			});
+			}, nullptr});
 			continue;
 		}
 		if (entry.server_side_only && client_side) {
-			if (verbose) strf::to(stdout)(
+			if (verbose) strf::to(Script::output())(
 				"Skipping server-side-only dynamic call '",
 				machine().memory.memstring(entry.strname), "'\n");
-			this->m_dyncall_array.push_back(
-			[] (auto&) {
+			handlers.push_back({
+			[] (Script&, void*) {
 				throw std::runtime_error("Serverside-only dynamic call triggered");
-			});
+			}, nullptr});
 			continue;
 		}
 
-		auto it = m_dynamic_functions.find(entry.hash);
-		if (LIKELY(it != m_dynamic_functions.end()))
+		const auto* host = m_dynamic_functions.find(entry.hash);
+		if (LIKELY(host != nullptr && host->handler.func != nullptr))
 		{
-			this->m_dyncall_array.push_back(it->second.func);
+			handlers.push_back(host->handler);
 		} else {
-			this->m_dyncall_array.push_back(
-			[] (auto&) {
-				throw std::runtime_error("Unimplemented dynamic call triggered");
-			});
+			// Resolved again when a dynamic call is registered
+			handlers.push_back({&Script::unresolved_dyncall, (void*)uintptr_t(i)});
 			if (verbose) {
 			const std::string name = machine().memory.memstring(entry.strname);
 			strf::to(stderr)(
 				"WARNING: Unimplemented dynamic function '", name, "' with hash ",
 				strf::hex(entry.hash), " and program table index ", i, " (total: ",
-				m_dyncall_array.size(), ")\n");
+				handlers.size(), ")\n");
 			}
-			unimplemented++;
+			resolved->unimplemented++;
 		}
 	}
-	if (m_dyncall_array.size() != entries)
+	if (handlers.size() != entries)
 		throw std::runtime_error("Mismatching number of dynamic call array entries");
-	strf::to(stdout)(
-		"* Resolved dynamic calls for '", name(), "' with ", entries, " entries, ",
-		unimplemented, " unimplemented\n");
+	// Refreshes after a registration are only reported when debugging
+	if (shared == nullptr || m_is_debug)
+		strf::to(Script::output())(
+			"* Resolved dynamic calls for '", name(), "' with ", entries, " entries, ",
+			resolved->unimplemented, " unimplemented\n");
+
+	m_program->share_resolved_dyncalls(resolved);
+	this->use_dynamic_calls(std::move(resolved));
+}
+
+void Script::use_dynamic_calls(std::shared_ptr<const Program::ResolvedDyncalls> resolved)
+{
+	this->m_dyncall_array = resolved->handlers;
+	this->m_resolved_dyncalls = std::move(resolved);
+}
+
+bool Script::refresh_dynamic_calls()
+{
+	const uint64_t epoch = m_dynamic_functions.epoch();
+	if (m_resolved_dyncalls->epoch == epoch)
+		return false;
+
+	// Only the unresolved entries are resolved again. Handlers resolved
+	// before are kept, even when they have been replaced since, and so
+	// the refreshed table belongs to this instance alone.
+	const auto& table = m_program->dyncall_table(machine()).entries;
+	auto refreshed = std::make_shared<Program::ResolvedDyncalls>(*m_resolved_dyncalls);
+	refreshed->epoch = epoch;
+	for (size_t i = 0; i < refreshed->handlers.size(); i++)
+	{
+		auto& handler = refreshed->handlers[i];
+		if (handler.func != &Script::unresolved_dyncall)
+			continue;
+		const auto* host = m_dynamic_functions.find(table.at(i).hash);
+		if (host != nullptr && host->handler.func != nullptr) {
+			handler = host->handler;
+			refreshed->unimplemented--;
+		}
+	}
+	this->use_dynamic_calls(std::move(refreshed));
+	return true;
+}
+
+bool Script::batch_call(const gaddr_t* records, size_t count, size_t stride)
+{
+	if (count == 0)
+		return true;
+	if (stride < 1 || stride > MAX_BATCH_ARGS + 1)
+		throw std::runtime_error("Script::batch_call(): Invalid number of arguments");
+
+	static constexpr auto trampoline = "event_batch_trampoline"_fn;
+	const auto address = this->address_of(trampoline);
+	if (UNLIKELY(address == 0x0))
+	{
+		this->could_not_find(trampoline.name());
+		return false;
+	}
+
+	const size_t bytes = count * stride * sizeof(gaddr_t);
+	// The records are reused by every batch, except for a batch made
+	// by a handler during another batch, which still needs its records
+	const bool nested = this->m_in_batch;
+	const gaddr_t g_records = nested ? this->guest_alloc(bytes)
+		: m_argument_arena.batch(machine(), bytes);
+	if (UNLIKELY(g_records == 0x0))
+		throw std::runtime_error("Script::batch_call(): Unable to allocate batch");
+	machine().copy_to_guest(g_records, records, bytes);
+
+	this->m_in_batch = true;
+	const bool success = this->call(address, g_records, count, stride).has_value();
+	this->m_in_batch = nested;
+	if (nested)
+		this->guest_free(g_records);
+	return success;
 }
 
 void Script::set_global_setting(std::string_view setting, gaddr_t value)
@@ -555,26 +797,3 @@ bool Script::guest_free(gaddr_t addr)
 {
 	return machine().arena().free(addr) == 0x0;
 }
-
-#include <unistd.h>
-
-std::vector<uint8_t> load_file(const std::string& filename)
-{
-	size_t size = 0;
-	FILE* f		= fopen(filename.c_str(), "rb");
-	if (f == NULL)
-		throw std::runtime_error("Could not open file: " + filename);
-
-	fseek(f, 0, SEEK_END);
-	size = ftell(f);
-	fseek(f, 0, SEEK_SET);
-
-	std::vector<uint8_t> result(size);
-	if (size != fread(result.data(), 1, size, f))
-	{
-		fclose(f);
-		throw std::runtime_error("Error when reading from file: " + filename);
-	}
-	fclose(f);
-	return result;
-}
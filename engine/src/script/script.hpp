@@ -1,12 +1,23 @@
 #pragma once
-#include <any>
+#include <array>
 #include <functional>
 #include <libriscv/machine.hpp>
 #include <libriscv/prepared_call.hpp>
 #include <optional>
+#include <span>
+#include <unordered_map>
 #include <unordered_set>
+#include "program_cache.hpp"
+#include "script_args.hpp"
+#include "script_arena.hpp"
 #include "script_depth.hpp"
+#include "script_profile.hpp"
+#include "script_registry.hpp"
+#include "script_return.hpp"
+#include "script_signature.hpp"
 template <typename T> struct GuestObjects;
+struct ScriptTask;
+struct FaultLog;
 
 struct Script
 {
@@ -19,37 +30,93 @@ struct Script
 	using machine_t		= riscv::Machine<MARCH>;
 	/// @brief A dynamic call callback function
 	using ghandler_t	= std::function<void(Script&)>;
+	/// @brief A resolved dynamic call handler: A plain function pointer,
+	/// and the userdata it is called with
+	using DyncallHandler = Program::DyncallHandler;
 	/// @brief A callback for when Game::exit() is called inside a Script program
 	using exit_func_t 	= std::function<void(Script&)>;
 
+	/// @brief An immutable machine state that new instances can be forked from
+	struct Snapshot;
+	/// @brief How the memory of a new instance relates to its snapshot
+	enum class CloneMode : uint8_t {
+		/// @brief The instance gets a private memory arena
+		Private,
+		/// @brief Pages are shared with the snapshot until first written to
+		CopyOnWrite,
+	};
+
+	/// @brief When a new instance creates and boots its machine
+	enum class BootMode : uint8_t {
+		/// @brief During construction
+		Eager,
+		/// @brief On first use, or when warm() is called
+		Deferred,
+	};
+
 	/// @brief The total physical memory of the program
 	static constexpr gaddr_t MAX_MEMORY	= 1024 * 1024 * 24ull;
 	/// @brief A virtual memory area set aside for the initial stack
 	static constexpr gaddr_t STACK_SIZE	= 1024 * 1024 * 2ull;
 	/// @brief A virtual memory area set aside for the heap
 	static constexpr gaddr_t MAX_HEAP	= MAX_MEMORY * 2ull;
-	/// @brief The max number of instructions allowed during startup
+	/// @brief The time spent in each phase of booting an instance, in nanoseconds
+	struct StartupTimes {
+		/// @brief Loading the program binary. Shared by all its instances.
+		int64_t load_file = 0;
+		/// @brief Constructing the machine, which parses the ELF program,
+		/// and also binary translates it when translation is enabled
+		int64_t construct = 0;
+		/// @brief System calls, heap and remote call setup
+		int64_t machine_setup = 0;
+		int64_t resolve_dynamic_calls = 0;
+		int64_t setup_linux = 0;
+		/// @brief Running the program through its initialization
+		int64_t simulate = 0;
+		bool binary_translated = false;
+	};
+
+	/// @brief The default max number of instructions allowed during startup
 	static constexpr uint64_t MAX_BOOT_INSTR = 32'000'000ull;
-	/// @brief The max number of instructions allowed during calls
+	/// @brief The default max number of instructions allowed during calls
 	static constexpr uint64_t MAX_CALL_INSTR = 32'000'000ull;
 	/// @brief The max number of recursive calls into the Machine allowed
 	/// A recursive call is when a guest program makes a host call that
 	/// in turn makes another guest vmcall. Both a security and QoL feature.
 	static constexpr uint8_t  MAX_CALL_DEPTH = 8;
+	/// @brief The max number of arguments to each call in a batch
+	static constexpr size_t MAX_BATCH_ARGS = 7;
 
 	/// @brief Make a function call into the script
+	/// @tparam R The return type, an integer by default. See: ScriptReturn
 	/// @param func The function to call. Must be a visible symbol in the program.
 	/// @param args The arguments to pass to the function.
-	/// @return The optional integral return value.
-	template <typename... Args>
-	std::optional<Script::sgaddr_t> call(const std::string& func, Args&&... args);
+	/// @return The optional return value.
+	template <typename R = sgaddr_t, typename... Args>
+	std::optional<R> call(std::string_view func, Args&&... args);
+
+	/// @brief Make a function call into the script
+	/// @param func A handle to the function, eg. "my_function"_fn
+	/// @param args The arguments to pass to the function.
+	/// @return The optional return value.
+	template <typename R = sgaddr_t, typename... Args>
+	std::optional<R> call(const ScriptFunction& func, Args&&... args);
 
 	/// @brief Make a function call into the script
 	/// @param addr The functions direct address.
 	/// @param args The arguments to pass to the function.
-	/// @return The optional integral return value.
-	template <typename... Args>
-	std::optional<Script::sgaddr_t> call(gaddr_t addr, Args&&... args);
+	/// @return The optional return value.
+	template <typename R = sgaddr_t, typename... Args>
+	std::optional<R> call(gaddr_t addr, Args&&... args);
+
+	/// @brief Make a function call into the script, with an instruction
+	/// budget other than the budget of this instance.
+	/// @param budget The max number of instructions the call may use.
+	/// @param addr The functions direct address.
+	/// @param args The arguments to pass to the function.
+	/// @return The optional return value.
+	template <typename R = sgaddr_t, typename... Args>
+	std::optional<R> call_with_budget(uint64_t budget, gaddr_t addr, Args&&... args);
 
 	/// @brief Make a preempted function call into the script, saving and
 	/// restoring the current execution state.
@@ -57,9 +124,17 @@ struct Script
 	/// such that it can be resumed like normal later on.
 	/// @param func The function to call. Must be a visible symbol in the program.
 	/// @param args The arguments to the function call.
-	/// @return The optional integral return value.
-	template <typename... Args>
-	std::optional<Script::sgaddr_t> preempt(const std::string& func, Args&&... args);
+	/// @return The optional return value.
+	template <typename R = sgaddr_t, typename... Args>
+	std::optional<R> preempt(std::string_view func, Args&&... args);
+
+	/// @brief Make a preempted function call into the script, saving and
+	/// restoring the current execution state.
+	/// @param func A handle to the function, eg. "my_function"_fn
+	/// @param args The arguments to the function call.
+	/// @return The optional return value.
+	template <typename R = sgaddr_t, typename... Args>
+	std::optional<R> preempt(const ScriptFunction& func, Args&&... args);
 
 	/// @brief Make a preempted function call into the script, saving and
 	/// restoring the current execution state.
@@ -67,9 +142,17 @@ struct Script
 	/// such that it can be resumed like normal later on.
 	/// @param addr The functions address to call.
 	/// @param args The arguments to the function call.
-	/// @return The optional integral return value.
-	template <typename... Args>
-	std::optional<Script::sgaddr_t> preempt(gaddr_t addr, Args&&... args);
+	/// @return The optional return value.
+	template <typename R = sgaddr_t, typename... Args>
+	std::optional<R> preempt(gaddr_t addr, Args&&... args);
+
+	/// @brief Make many function calls into the script with a single entry into
+	/// the virtual machine, through a trampoline in the programs libc. All the
+	/// calls share the instruction budget of one call. See: Event::call_batch()
+	/// @param records count records of stride addresses: The function to call,
+	/// followed by up to MAX_BATCH_ARGS integral arguments.
+	/// @return True if all the calls completed.
+	bool batch_call(const gaddr_t* records, size_t count, size_t stride);
 
 	/// @brief Resume execution of the script, until @param instruction_count has been reached,
 	/// then stop execution and return. This function can be used to drive long-running tasks
@@ -77,6 +160,82 @@ struct Script
 	/// @param instruction_count The max number of instructions to execute before returning.
 	bool resume(uint64_t instruction_count);
 
+	/// @brief Start a function call that may run over many engine ticks. Nothing
+	/// is executed until the returned task is resumed. While the task is in
+	/// progress, other calls into the script are made as preempted calls.
+	/// Only one async call can be in progress per instance. See: script_task.hpp
+	/// @param addr The functions direct address.
+	/// @param args The arguments to pass to the function.
+	/// @return A task that must be resumed until done.
+	template <typename... Args>
+	ScriptTask async_call(gaddr_t addr, Args&&... args);
+
+	/// @brief Start a function call that may run over many engine ticks.
+	/// @param func A handle to the function, eg. "my_function"_fn
+	/// @param args The arguments to pass to the function.
+	/// @return A task that must be resumed until done.
+	template <typename... Args>
+	ScriptTask async_call(const ScriptFunction& func, Args&&... args);
+
+	/// @brief True if an async call has been started and is not yet done.
+	bool has_async_call() const noexcept { return m_async_call; }
+
+	/// @brief Instruction accounting for a single entry point into the script
+	struct CallStats {
+		uint64_t calls = 0;
+		/// @brief Instructions used by calls that completed, and which
+		/// were not nested inside another call
+		uint64_t instructions = 0;
+		/// @brief Calls that ran out of instructions
+		uint64_t overruns = 0;
+	};
+
+	/// @brief The max number of instructions each call may use, unless
+	/// another budget is given. Defaults to MAX_CALL_INSTR.
+	uint64_t call_budget() const noexcept { return m_call_budget; }
+	void set_call_budget(uint64_t budget) noexcept { m_call_budget = budget; }
+	/// @brief The max number of instructions booting may use. Only affects
+	/// instances that have not booted yet. Defaults to MAX_BOOT_INSTR.
+	uint64_t boot_budget() const noexcept { return m_boot_budget; }
+	void set_boot_budget(uint64_t budget) noexcept { m_boot_budget = budget; }
+
+	/// @brief Accounting of every function called from the host, by address.
+	const std::unordered_map<gaddr_t, CallStats>& call_stats() const noexcept
+	{
+		return m_call_stats;
+	}
+	/// @brief Accounting of a single function called from the host.
+	CallStats call_stats(gaddr_t address) const;
+	void reset_call_stats() { m_call_stats.clear(); }
+	/// @brief The total number of calls that ran out of instructions.
+	uint64_t budget_overruns() const noexcept { return m_budget_overruns; }
+
+	/// @brief Copy a string into guest memory once, so that calls can pass
+	/// it by address from then on, eg. script.call("on_event", script.intern("hit"))
+	/// @param str The string to intern.
+	/// @return The string in guest memory, passed to the guest as a const char*.
+	GuestString intern(std::string_view str)
+	{
+		return m_argument_arena.intern(machine(), str);
+	}
+	/// @brief Copy an object into guest memory for the rest of the frame,
+	/// so that calls can pass it by reference without copying it again.
+	/// @param object The object to place. Must be trivially copyable.
+	/// @return The object in guest memory, passed to the guest as a reference.
+	template <typename T> GuestRef<T> place(const T& object)
+	{
+		return m_argument_arena.place(machine(), object);
+	}
+	/// @brief Forget every object placed during this frame.
+	void reset_frame_arguments() noexcept
+	{
+		m_argument_arena.reset_frame();
+	}
+	const ArgumentArena& argument_arena() const noexcept
+	{
+		return m_argument_arena;
+	}
+
 	/// @brief Returns the pointer provided at instantiation of the Script instance.
 	/// @tparam T The real type of the user-provided pointer.
 	/// @return Returns the user-provided pointer.
@@ -99,14 +258,23 @@ struct Script
 	std::string symbol_name(gaddr_t address) const;
 
 	/// @brief Look up the address of a name. Returns 0x0 if not found.
-	/// Uses an unordered_map to remember lookups in order to speed up future lookups.
+	/// The symbol index is built once per program, and shared between all its instances.
 	/// @param name The name to find the virtual address for.
 	/// @return The virtual address of name, or 0x0 if not found.
-	gaddr_t address_of(const std::string& name) const;
+	gaddr_t address_of(std::string_view name) const;
+	/// @brief Look up the address of a function handle, using its precomputed hash.
+	gaddr_t address_of(const ScriptFunction& func) const
+	{
+		return m_program->address_of(func);
+	}
 
 	/// Install a callback function using a string definition
 	/// Dynamic calls be invoked from the guest using the same string name,
 	/// but it is implemented as if it was a native function.
+	/// Instances booted from now on use the new handler. Existing instances,
+	/// and clones of snapshots taken before, keep the handlers they resolved,
+	/// which stay alive for as long as the registry. Only their unresolved
+	/// dynamic calls pick up new handlers, on the next call to one of them.
 	/// @param def The string definition of the function.
 	/// @param func The callback function to invoke, handling the call.
 	/// @example Script::set_dynamic_call("int my_function(int, int)",
@@ -117,10 +285,52 @@ struct Script
 	/// });
 	static void set_dynamic_call(const std::string& def, ghandler_t);
 	static void set_dynamic_call(std::string name, std::string def, ghandler_t);
+	/// @brief Install a plain function as a dynamic call handler, which is
+	/// called directly, without going through a std::function.
+	/// @param userdata A pointer passed to every call of the function.
+	static void set_dynamic_call(std::string name, std::string def,
+		DyncallHandler::func_t func, void* userdata);
+	/// @brief Install a lambda without captures as a dynamic call handler,
+	/// which is called directly, without going through a std::function.
+	template <typename F>
+	requires (std::is_empty_v<F> && std::is_default_constructible_v<F>
+		&& std::is_invocable_v<F, Script&>)
+	static void set_dynamic_call(std::string name, std::string def, F)
+	{
+		set_dynamic_call(std::move(name), std::move(def),
+			[] (Script& script, void*) { F{}(script); }, nullptr);
+	}
+	template <typename F>
+	requires (std::is_empty_v<F> && std::is_default_constructible_v<F>
+		&& std::is_invocable_v<F, Script&>)
+	static void set_dynamic_call(const std::string& def, F func)
+	{
+		set_dynamic_call(def, def, func);
+	}
+	/// @brief Install a dynamic call handler taking typed arguments. The
+	/// definition is parsed and hashed at compile-time, and the parameters
+	/// of the handler are checked against it. A std::string_view or a
+	/// std::span consumes a pointer and a size. A non-void return value
+	/// becomes the result of the call.
+	/// @example Script::bind<"int my_function (int, int)">(
+	/// [](Script&, int a, int b) { return a + b; });
+	template <DyncallSignature Def, typename F>
+	static void bind(F func);
 	static void
 		set_dynamic_calls(std::vector<std::tuple<std::string, std::string, ghandler_t>>);
 	void dynamic_call_hash(uint32_t hash, gaddr_t strname);
 	void dynamic_call_array(uint32_t idx);
+#ifdef DYNCALL_PROFILING
+	/// @brief Counters and host time of the dynamic calls made by this instance.
+	DyncallProfile& dyncall_profile() noexcept { return m_dyncall_profile; }
+	const DyncallProfile& dyncall_profile() const noexcept { return m_dyncall_profile; }
+	/// @brief The dynamic calls made by this instance as a table,
+	/// sorted by host time, most first.
+	std::string dyncall_profile_table() const;
+	/// @brief The dynamic calls made by this instance as JSON, sorted
+	/// by host time, including the host time histograms.
+	std::string dyncall_profile_json() const;
+#endif
 
 	/// @brief Retrieve arguments passed to a dynamic call, specifying each type.
 	/// @tparam ...Args The types of arguments to retrieve.
@@ -136,22 +346,45 @@ struct Script
 	template <typename... Args>
 	void set_result(Args&&... results);
 
-	auto& dynargs()
+	/// @brief The arguments of the current dynamic argument call.
+	/// String arguments are views into guest memory, only valid
+	/// for the duration of the call.
+	/// @example auto text = script.dynargs().get<std::string_view>(0);
+	ScriptArgs& dynargs()
 	{
 		return m_arguments;
 	}
 
 	/// @brief The virtual machine hosting the Scripts program.
+	/// A deferred instance is booted on first access.
 	/// @return The underlying virtual machine.
 	auto& machine()
 	{
+		if (UNLIKELY(m_machine == nullptr))
+			this->boot();
 		return *m_machine;
 	}
 	const auto& machine() const
 	{
+		if (UNLIKELY(m_machine == nullptr))
+			const_cast<Script*>(this)->boot();
 		return *m_machine;
 	}
 
+	/// @brief Boot a deferred instance now, eg. during a loading screen.
+	/// Does nothing if the instance has already booted.
+	void warm()
+	{
+		if (m_machine == nullptr)
+			this->boot();
+	}
+
+	/// @brief Check if the machine of this instance has been booted.
+	bool is_booted() const noexcept
+	{
+		return m_machine != nullptr;
+	}
+
 	/// @brief The name given to this Script instance during creation.
 	/// @return The name of this Script instance.
 	const auto& name() const noexcept
@@ -166,6 +399,23 @@ struct Script
 		return m_hash;
 	}
 
+	/// @brief The program this Script instance is running, which is shared
+	/// with every other instance created from the same binary.
+	/// @return The shared program.
+	const Program& program() const noexcept
+	{
+		return *m_program;
+	}
+
+	/// @brief How long each phase of booting this instance took.
+	/// Instances forked from a snapshot do not boot, and report zeroes.
+	const StartupTimes& startup_times() const noexcept
+	{
+		return m_startup;
+	}
+	/// @brief The startup times of this instance as a JSON object.
+	std::string startup_report() const;
+
 	/// @brief The filename passed to this Script instance during creation.
 	/// @return The filename of this Script instance.
 	const auto& filename() const noexcept
@@ -181,6 +431,30 @@ struct Script
 	void print(std::string_view text);
 	void print_backtrace(const gaddr_t addr);
 
+	/// @brief The file that Script output is written to on the calling thread.
+	/// @return The redirected file, or stdout by default.
+	static FILE* output() noexcept
+	{
+		return (t_output != nullptr) ? t_output : stdout;
+	}
+	/// @brief Redirect all Script output on the calling thread.
+	/// @param file The file to write to, or nullptr to restore stdout.
+	static void set_output(FILE* file) noexcept
+	{
+		t_output = file;
+	}
+	/// @brief Record faults in all scripts into a fault log, instead of
+	/// printing them immediately. See: script_faults.hpp
+	/// @param log The fault log, or nullptr to print faults immediately.
+	static void set_fault_log(FaultLog* log) noexcept
+	{
+		m_fault_log = log;
+	}
+	static FaultLog* fault_log() noexcept
+	{
+		return m_fault_log;
+	}
+
 	void stdout_enable(bool e) noexcept
 	{
 		m_stdout = e;
@@ -193,6 +467,27 @@ struct Script
 
 	long vmbench(gaddr_t address, size_t ntimes = 30);
 	static long benchmark(std::function<void()>, size_t ntimes = 1000);
+	/// @brief Measure how many clones of this instance fit in 1GB of
+	/// resident memory, for each clone mode. Requires a snapshot.
+	/// @param instances The number of clones to create for each mode.
+	void clone_benchmark(size_t instances = 100);
+	/// @brief Measure the time and private memory it takes to load and
+	/// instantiate the program file of this instance, for each storage.
+	/// @param instances The number of machines to create for each storage.
+	void load_benchmark(size_t instances = 10);
+	/// @brief Compare the latency of leasing an instance of this program
+	/// from a ScriptPool and returning it, to constructing a new instance.
+	/// Also compares calls to "touch_memory" in a plain and a pooled instance.
+	/// @param rounds The number of instances to construct and lease.
+	void pool_benchmark(size_t rounds = 100);
+	/// @brief Benchmark prepared calls made 1, 2 and 4 deep, against
+	/// machine_t::preempt() at the same depth. The deeper calls are made
+	/// from a dynamic call, which is only used to reach the depth.
+	/// The "Test::nested" handler is restored afterwards.
+	/// @param func A function taking a depth, which calls the dynamic call
+	/// "Test::nested" with depth - 1 while the depth is above zero.
+	/// @param rounds The number of calls at each depth.
+	void nested_benchmark(gaddr_t func, size_t rounds = 1000);
 
 	void add_shared_memory();
 
@@ -276,41 +571,112 @@ struct Script
 	/// @return The script instance with the given name.
 	static Script& Find(const std::string& name);
 
+	/// @brief Capture the current state of this instance, so that new instances
+	/// can be created from it without re-running the programs initialization.
+	/// The machine is handed over to the snapshot, and this instance continues
+	/// on a copy-on-write fork of it. Must be taken before remote calls are set up.
+	/// The machine must never run again, so machine references, Events,
+	/// PreparedCalls and GuestObjects taken before must be created again.
+	/// @return The snapshot, which is also used by future clone() calls.
+	std::shared_ptr<const Snapshot> snapshot();
+
+	/// @brief Remember the current state of this instance, so that it can be
+	/// restored with rollback(). The instance continues on a copy-on-write fork
+	/// of the checkpoint, which keeps track of every page written to since.
+	/// Taking another checkpoint moves the written pages into the checkpoint.
+	/// Not available on copy-on-write clones, or after remote calls are set up.
+	/// Like with snapshot(), the first checkpoint replaces the machine, and
+	/// everything that refers to the previous machine must be created again.
+	/// The fork has no flat memory arena, so from now on every memory access
+	/// goes through the page tables, which makes calls slower.
+	/// See: pool_benchmark()
+	void checkpoint();
+	/// @brief Throw away all guest side effects since the last checkpoint.
+	/// Only the pages written since then are restored, along with registers,
+	/// the heap arena and the mmap area. Guest threads are not rolled back.
+	/// Not available during a call, or while an async call is in progress.
+	/// @return The number of pages that were restored.
+	size_t rollback();
+	/// @brief Check if this instance has a checkpoint to roll back to.
+	bool has_checkpoint() const noexcept
+	{
+		return m_checkpoint != nullptr;
+	}
+
 	/// @brief Make a prepared function call into the script
 	/// @param pcall The prepared call object.
 	/// @param args The arguments to pass to the function.
-	/// @return The optional integral return value.
-	template <typename F, typename... Args>
-	std::optional<Script::sgaddr_t> prepared_call(riscv::PreparedCall<MARCH, F, MAX_CALL_INSTR>& pcall, Args&&... args);
+	/// @return The optional return value.
+	template <typename F, typename R = sgaddr_t, typename... Args>
+	std::optional<R> prepared_call(riscv::PreparedCall<MARCH, F, MAX_CALL_INSTR>& pcall, Args&&... args);
 
 	// Create new Script instance from file
 	Script(
 		const std::string& name, const std::string& filename,
-		bool dbg = false, void* userptr = nullptr);
+		bool dbg = false, void* userptr = nullptr, BootMode boot = BootMode::Eager);
 	// Create new Script instance from existing binary
 	Script(
 		std::shared_ptr<const std::vector<uint8_t>> binary, const std::string& name,
-		const std::string& filename, bool dbg = false, void* userptr = nullptr);
+		const std::string& filename, bool dbg = false, void* userptr = nullptr,
+		BootMode boot = BootMode::Eager);
+	// Create new Script instance from a cached program
+	Script(
+		std::shared_ptr<const Program> program, const std::string& name,
+		const std::string& filename, bool dbg = false, void* userptr = nullptr,
+		BootMode boot = BootMode::Eager);
+	// Create new Script instance from a snapshot
+	Script(
+		std::shared_ptr<const Snapshot> snapshot, const std::string& name,
+		void* userptr = nullptr, CloneMode mode = CloneMode::Private);
 	// Create new Script instance from cloning another Script
-	Script clone(const std::string& name, void* userptr = nullptr);
+	// Uses the latest snapshot, if there is one, and otherwise boots anew.
+	Script clone(const std::string& name, void* userptr = nullptr,
+		CloneMode mode = CloneMode::Private);
 	~Script();
 
   private:
+	friend struct ScriptTask;
 	static void setup_syscall_interface();
+	riscv::MachineOptions<MARCH> machine_options() const;
+	void boot();
 	void reset(); // true if the reset was successful
 	void initialize();
+	void fork_from(const Snapshot&);
+	size_t restore_dirty_pages(bool commit);
 	void could_not_find(std::string_view);
-	void handle_exception(gaddr_t);
+	void handle_exception(gaddr_t, const std::exception&);
 	void handle_timeout(gaddr_t);
+	void record_fault(gaddr_t, const std::exception&);
+	CallStats& account_call(gaddr_t address)
+	{
+		// Elements of the map are never moved
+		auto& stats = m_call_stats[address];
+		stats.calls++;
+		return stats;
+	}
 	void max_depth_exceeded(gaddr_t);
+	struct PreemptState;
+	template <typename R, typename... Args>
+	R preempt_call(uint64_t budget, gaddr_t address, Args&&... args);
 	void machine_setup();
+	void machine_instance_setup();
 	void machine_remote_setup();
+	riscv::Page* cow_page_fault(riscv::Memory<MARCH>&, gaddr_t pageno);
+	const riscv::Page* cow_page_read(gaddr_t pageno);
 	void resolve_dynamic_calls(bool initialization, bool client_side, bool verbose);
+	void use_dynamic_calls(std::shared_ptr<const Program::ResolvedDyncalls>);
+	bool refresh_dynamic_calls();
 	void dynamic_call_error(uint32_t idx, const std::exception& e);
 	static long finish_benchmark(std::vector<long>&);
 
+	// Members are destroyed in reverse order, so the machine goes first,
+	// before the checkpoint, snapshot and program binary it references.
+	std::shared_ptr<const Program> m_program;
+	std::shared_ptr<const Snapshot> m_snapshot = nullptr;
+	/// @brief The machine this instance rolls back to. It must outlive
+	/// m_machine, which references its pages.
+	std::unique_ptr<machine_t> m_checkpoint = nullptr;
 	std::unique_ptr<machine_t> m_machine = nullptr;
-	std::shared_ptr<const std::vector<uint8_t>> m_binary;
 	void* m_userptr = nullptr;
 	gaddr_t m_heap_area		= 0;
 	std::string m_name;
@@ -320,124 +686,304 @@ struct Script
 	bool m_is_debug			= false;
 	bool m_stdout			= true;
 	bool m_last_newline		= true;
-	int  m_budget_overruns	= 0;
+	bool m_async_call		= false;
+	bool m_in_batch			= false;
+	uint64_t m_budget_overruns = 0;
+	uint64_t m_call_budget  = MAX_CALL_INSTR;
+	uint64_t m_boot_budget  = MAX_BOOT_INSTR;
+	std::unordered_map<gaddr_t, CallStats> m_call_stats;
+	StartupTimes m_startup;
 	Script* m_remote_script = nullptr;
+	/// @brief The snapshot or checkpoint machine whose pages are shared copy-on-write
+	const machine_t* m_cow_source = nullptr;
 	/// @brief Functions accessible when remote access is *strict*
 	std::unordered_set<gaddr_t> m_remote_access;
+	/// @brief Interned strings and placed objects passed as arguments,
+	/// and the state of the arena when the checkpoint was made
+	ArgumentArena m_argument_arena;
+	ArgumentArena m_checkpoint_arguments;
 	/// @brief List of arguments added by dynamic arguments feature
-	std::vector<std::any> m_arguments;
-	/// @brief Cached addresses for symbol lookups
-	/// This could probably be improved by doing it per-binary instead
-	/// of a separate cache per instance. But at least it's thread-safe.
-	mutable std::unordered_map<std::string, gaddr_t> m_lookup_cache;
+	ScriptArgs m_arguments;
 	// dynamic call array, lazily resolved at run-time
-	struct DyncallDesc {
-		uint32_t hash;
-		uint32_t resv;
-		uint32_t strname;
-		bool initialization_only;
-		bool client_side_only;
-		bool server_side_only;
-	};
-	std::vector<ghandler_t> m_dyncall_array;
+	using DyncallDesc = Program::DyncallDesc;
+	// shared by every instance of the program in the same mode
+	std::shared_ptr<const Program::ResolvedDyncalls> m_resolved_dyncalls;
+	std::span<const DyncallHandler> m_dyncall_array;
 	gaddr_t m_g_dyncall_table = 0x0;
+#ifdef DYNCALL_PROFILING
+	struct DyncallProfileRow;
+	std::vector<DyncallProfileRow> dyncall_profile_rows() const;
+	DyncallProfile m_dyncall_profile;
+#endif
 	// Map of functions that extend engine using string hashes
 	// The host-side implementation:
 	struct HostDyncall {
 		std::string name;
 		std::string definition;
+		/// @brief Owns the callback of handlers installed as a std::function
 		ghandler_t  func;
+		DyncallHandler handler;
 	};
-	static inline std::map<uint32_t, HostDyncall> m_dynamic_functions;
+	static void register_dynamic_call(std::string name, std::string def,
+		ghandler_t func, DyncallHandler handler);
+	static void register_dynamic_call(uint32_t hash, std::string name, std::string def,
+		ghandler_t func, DyncallHandler handler);
+	template <typename F, typename... Args>
+	static void call_bound(Script&, F&, std::tuple<Args...>*);
+	static void call_dyncall_function(Script&, void* func);
+	static void unresolved_dyncall(Script&, void* index);
+	/// @brief Lock-free lookups, so that instances on other threads can
+	/// resolve dynamic calls while new ones are being registered
+	static inline HashRegistry<HostDyncall> m_dynamic_functions;
 	// map of globally accessible run-time settings
 	static inline std::map<std::string, gaddr_t, std::less<>> m_runtime_settings;
 	static inline exit_func_t m_exit = nullptr;
+	static inline thread_local FILE* t_output = nullptr;
+	static inline FaultLog* m_fault_log = nullptr;
+};
+
+struct Script::Snapshot
+{
+	/// @brief The captured machine, which never runs again
+	std::unique_ptr<machine_t> machine;
+	std::shared_ptr<const Program> program;
+	std::string filename;
+	gaddr_t heap_area;
+	gaddr_t dyncall_table;
+	std::shared_ptr<const Program::ResolvedDyncalls> dyncalls;
+	bool is_debug;
 };
 
 static_assert(
 	RISCV_ARCH == 32 || RISCV_ARCH == 64,
 	"Architecture must be 32- or 64-bit");
 
-template <typename... Args>
-inline std::optional<Script::sgaddr_t> Script::call(gaddr_t address, Args&&... args)
+template <typename R, typename... Args>
+inline std::optional<R> Script::call(gaddr_t address, Args&&... args)
+{
+	return this->call_with_budget<R>(m_call_budget, address, std::forward<Args>(args)...);
+}
+
+template <typename R, typename... Args>
+inline std::optional<R> Script::call_with_budget(uint64_t budget, gaddr_t address, Args&&... args)
 {
 	ScriptDepthMeter meter(this->m_call_depth);
 	try
 	{
-		if (LIKELY(meter.is_one()))
-			return {machine().vmcall<MAX_CALL_INSTR>(
-				address, std::forward<Args>(args)...)};
+		if (LIKELY(meter.is_one() && !m_async_call))
+		{
+			// The same as vmcall(), but with a run-time budget
+			auto& m = machine();
+			auto& stats = this->account_call(address);
+			m.cpu.reset_stack_pointer();
+			m.setup_call(guest_argument(std::forward<Args>(args))...);
+			m.cpu.jump(address);
+			m.simulate(budget);
+			stats.instructions += m.instruction_counter();
+			return {ScriptReturn<R>::get(m)};
+		}
 		else if (LIKELY(meter.get() < MAX_CALL_DEPTH))
-			return {machine().preempt(MAX_CALL_INSTR,
+		{
+			this->account_call(address);
+			return {this->preempt_call<R>(budget,
 				address, std::forward<Args>(args)...)};
+		}
 		else
 			this->max_depth_exceeded(address);
 	}
 	catch (const std::exception& e)
 	{
-		this->handle_exception(address);
+		this->handle_exception(address, e);
 	}
 	return std::nullopt;
 }
 
-template <typename... Args>
-inline std::optional<Script::sgaddr_t> Script::call(const std::string& func, Args&&... args)
+template <typename R, typename... Args>
+inline std::optional<R> Script::call(std::string_view func, Args&&... args)
 {
-	const auto address = this->address_of(func.c_str());
+	const auto address = this->address_of(func);
 	if (UNLIKELY(address == 0x0))
 	{
 		this->could_not_find(func);
 		return std::nullopt;
 	}
-	return {this->call(address, std::forward<Args>(args)...)};
+	return {this->call<R>(address, std::forward<Args>(args)...)};
 }
 
-template <typename F, typename... Args>
-inline std::optional<Script::sgaddr_t> Script::prepared_call(riscv::PreparedCall<MARCH, F, MAX_CALL_INSTR>& pcall, Args&&... args)
+template <typename R, typename... Args>
+inline std::optional<R> Script::call(const ScriptFunction& func, Args&&... args)
 {
+	const auto address = this->address_of(func);
+	if (UNLIKELY(address == 0x0))
+	{
+		this->could_not_find(func.name());
+		return std::nullopt;
+	}
+	return {this->call<R>(address, std::forward<Args>(args)...)};
+}
+
+template <typename F, typename R, typename... Args>
+inline std::optional<R> Script::prepared_call(riscv::PreparedCall<MARCH, F, MAX_CALL_INSTR>& pcall, Args&&... args)
+{
+	// Prepared calls have the default budget built in
+	if (UNLIKELY(m_call_budget != MAX_CALL_INSTR))
+		return this->call_with_budget<R>(m_call_budget, pcall.address(), std::forward<Args>(args)...);
+
 	ScriptDepthMeter meter(this->m_call_depth);
 	try
 	{
-		if (LIKELY(meter.is_one()))
-			return {pcall.call_with(*m_machine, std::forward<Args>(args)...)};
+		if (LIKELY(meter.is_one() && !m_async_call))
+		{
+			// A deferred instance boots here, on its first call
+			auto& m = machine();
+			auto& stats = this->account_call(pcall.address());
+			pcall.call_with(m, guest_argument(std::forward<Args>(args))...);
+			stats.instructions += m.instruction_counter();
+			return {ScriptReturn<R>::get(m)};
+		}
 		else if (LIKELY(meter.get() < MAX_CALL_DEPTH))
-			return {machine().preempt(MAX_CALL_INSTR, pcall.address(),
+		{
+			this->account_call(pcall.address());
+			return {this->preempt_call<R>(MAX_CALL_INSTR, pcall.address(),
 				std::forward<Args>(args)...)};
+		}
 		else
 			this->max_depth_exceeded(pcall.address());
 	}
 	catch (const std::exception& e)
 	{
-		this->handle_exception(pcall.address());
+		this->handle_exception(pcall.address(), e);
 	}
 	return std::nullopt;
 }
 
-template <typename... Args>
-inline std::optional<Script::sgaddr_t> Script::preempt(gaddr_t address, Args&&... args)
+template <typename R, typename... Args>
+inline std::optional<R> Script::preempt(gaddr_t address, Args&&... args)
 {
 	try
 	{
-		return {machine().preempt(
-			MAX_CALL_INSTR, address, std::forward<Args>(args)...)};
+		this->account_call(address);
+		return {this->preempt_call<R>(
+			m_call_budget, address, std::forward<Args>(args)...)};
 	}
 	catch (const std::exception& e)
 	{
-		this->handle_exception(address);
+		this->handle_exception(address, e);
 	}
 	return std::nullopt;
 }
 
-template <typename... Args>
-inline std::optional<Script::sgaddr_t> Script::preempt(const std::string& func, Args&&... args)
+template <typename R, typename... Args>
+inline std::optional<R> Script::preempt(std::string_view func, Args&&... args)
 {
-	const auto address = this->address_of(func.c_str());
+	const auto address = this->address_of(func);
 	if (UNLIKELY(address == 0x0))
 	{
 		this->could_not_find(func);
 		return std::nullopt;
 	}
-	return {this->preempt(address, std::forward<Args>(args)...)};
+	return {this->preempt<R>(address, std::forward<Args>(args)...)};
+}
+
+template <typename R, typename... Args>
+inline std::optional<R> Script::preempt(const ScriptFunction& func, Args&&... args)
+{
+	const auto address = this->address_of(func);
+	if (UNLIKELY(address == 0x0))
+	{
+		this->could_not_find(func.name());
+		return std::nullopt;
+	}
+	return {this->preempt<R>(address, std::forward<Args>(args)...)};
+}
+
+/// @brief The part of the execution state that a nested call is allowed to
+/// clobber, according to the calling convention. The called function itself
+/// preserves the callee-saved floating-point registers, fs0-fs11. All integer
+/// registers are saved, as they are few and hold most of the live values.
+/// Unlike machine_t::preempt(), the vector registers are never copied.
+struct Script::PreemptState
+{
+	using fpreg_t = std::decay_t<decltype(std::declval<machine_t&>().cpu.registers().getfl(0))>;
+	static constexpr uint8_t CALLER_SAVED_FP[] {
+		0, 1, 2, 3, 4, 5, 6, 7,         // ft0-ft7
+		10, 11, 12, 13, 14, 15, 16, 17, // fa0-fa7
+		28, 29, 30, 31,                 // ft8-ft11
+	};
+	static constexpr uint8_t CALLEE_SAVED_FP[] {
+		8, 9,                           // fs0-fs1
+		18, 19, 20, 21, 22, 23, 24, 25, 26, 27, // fs2-fs11
+	};
+
+	PreemptState(machine_t& m)
+	  : exec(&m.cpu.current_execute_segment()),
+		pc(m.cpu.pc()),
+		max_instructions(m.max_instructions()),
+		counter(m.instruction_counter())
+	{
+		for (unsigned i = 1; i < 32; i++)
+			xregs[i] = m.cpu.reg(i);
+		for (size_t i = 0; i < std::size(CALLER_SAVED_FP); i++)
+			fregs[i] = m.cpu.registers().getfl(CALLER_SAVED_FP[i]);
+		for (size_t i = 0; i < std::size(CALLEE_SAVED_FP); i++)
+			fsaved[i] = m.cpu.registers().getfl(CALLEE_SAVED_FP[i]);
+	}
+
+	/// @brief Return to the interrupted call, after the nested call returned.
+	/// The nested call has restored fs0-fs11 itself.
+	void restore(machine_t& m) const
+	{
+		for (unsigned i = 1; i < 32; i++)
+			m.cpu.reg(i) = xregs[i];
+		for (size_t i = 0; i < std::size(CALLER_SAVED_FP); i++)
+			m.cpu.registers().getfl(CALLER_SAVED_FP[i]) = fregs[i];
+		m.cpu.registers().pc = pc;
+		m.cpu.set_execute_segment(*exec);
+		m.set_max_instructions(max_instructions);
+		m.set_instruction_counter(counter);
+	}
+	/// @brief Return to the interrupted call, after the nested call failed
+	/// part-way, possibly without restoring fs0-fs11.
+	void restore_after_failure(machine_t& m) const
+	{
+		for (size_t i = 0; i < std::size(CALLEE_SAVED_FP); i++)
+			m.cpu.registers().getfl(CALLEE_SAVED_FP[i]) = fsaved[i];
+		this->restore(m);
+	}
+
+	std::remove_reference_t<decltype(std::declval<machine_t&>().cpu.current_execute_segment())>* exec;
+	gaddr_t pc;
+	uint64_t max_instructions;
+	uint64_t counter;
+	std::array<gaddr_t, 32> xregs;
+	std::array<fpreg_t, std::size(CALLER_SAVED_FP)> fregs;
+	std::array<fpreg_t, std::size(CALLEE_SAVED_FP)> fsaved;
+};
+
+template <typename R, typename... Args>
+inline R Script::preempt_call(uint64_t budget, gaddr_t address, Args&&... args)
+{
+	// The same as machine_t::preempt(), except that only the registers
+	// the calling convention requires are saved, and the return value is
+	// read before the registers of the interrupted call are restored
+	auto& m = machine();
+	const PreemptState state(m);
+	// Make some room on the stack below the interrupted call
+	m.cpu.reg(riscv::REG_SP) = (m.cpu.reg(riscv::REG_SP) - 16u) & ~gaddr_t(0xF);
+	try
+	{
+		m.setup_call(guest_argument(std::forward<Args>(args))...);
+		m.cpu.jump(address);
+		m.simulate(budget);
+	}
+	catch (...)
+	{
+		state.restore_after_failure(m);
+		throw;
+	}
+	const R result = ScriptReturn<R>::get(m);
+	state.restore(m);
+	return result;
 }
 
 inline bool Script::resume(uint64_t cycles)
@@ -449,7 +995,7 @@ inline bool Script::resume(uint64_t cycles)
 	}
 	catch (const std::exception& e)
 	{
-		this->handle_exception(machine().cpu.pc());
+		this->handle_exception(machine().cpu.pc(), e);
 		return false;
 	}
 }
@@ -465,6 +1011,55 @@ inline void Script::set_result(Args&&... results)
 	machine().set_result(std::forward<Args>(results)...);
 }
 
+template <typename F, typename... Args>
+inline void Script::call_bound(Script& script, F& func, std::tuple<Args...>*)
+{
+	using R = typename DyncallFunctionTraits<F>::ret;
+	auto invoke = [&] (auto&&... args) {
+		if constexpr (std::is_void_v<R>)
+			func(script, args...);
+		else
+			script.machine().set_result(func(script, args...));
+	};
+	if constexpr (sizeof...(Args) == 0)
+		invoke();
+	else
+		std::apply(invoke, script.machine().template sysargs<std::decay_t<Args>...>());
+}
+
+template <DyncallSignature Def, typename F>
+inline void Script::bind([[maybe_unused]] F func)
+{
+	using Traits = DyncallFunctionTraits<F>;
+	using Params = typename Traits::args;
+	static_assert(Def.valid, "Unable to parse the dynamic call definition");
+	static_assert(std::is_same_v<typename Traits::first, Script&>,
+		"The first parameter of a dynamic call handler must be Script&");
+	static_assert(DyncallTypeCheck::parameters_match<Def>((Params*)nullptr),
+		"The handler parameters do not match the dynamic call definition");
+	static_assert(DyncallTypeCheck::return_matches<Def, typename Traits::ret>(),
+		"The handler return type does not match the dynamic call definition");
+
+	std::string def {Def.view()};
+	if constexpr (std::is_empty_v<F> && std::is_default_constructible_v<F>)
+	{
+		const DyncallHandler handler {
+			[] (Script& script, void*) {
+				F func {};
+				call_bound(script, func, (Params*)nullptr);
+			}, nullptr};
+		register_dynamic_call(Def.hash, def, def,
+			[handler] (Script& script) { handler.func(script, nullptr); },
+			handler);
+	} else {
+		register_dynamic_call(Def.hash, def, def,
+			[func = std::move(func)] (Script& script) mutable {
+				call_bound(script, func, (Params*)nullptr);
+			},
+			DyncallHandler{&Script::call_dyncall_function, nullptr});
+	}
+}
+
 /**
  * This uses RAII to allocate a range of objects,
  * visible both in the host and in the script/guest.
@@ -503,6 +1098,26 @@ template <typename T> struct GuestObjects
 			riscv::ILLEGAL_OPERATION, "at(): Object is out of range", n);
 	}
 
+	/// @brief Call the function stored in the given member of every object,
+	/// passing the address of the object, entering the script only once.
+	/// Objects where the member is 0x0 are skipped.
+	/// @param member The member holding the function address, eg. &GameObject::onDeath
+	/// @return True if all the calls completed.
+	bool for_each_event(Script::gaddr_t T::*member)
+	{
+		std::vector<Script::gaddr_t> records;
+		records.reserve(m_count * 2);
+		for (size_t i = 0; i < m_count; i++)
+		{
+			if (m_object[i].*member != 0x0)
+			{
+				records.push_back(m_object[i].*member);
+				records.push_back(m_address + sizeof(T) * i);
+			}
+		}
+		return m_script.batch_call(records.data(), records.size() / 2, 2);
+	}
+
 	Script::gaddr_t address(size_t n) const
 	{
 		if (n < m_count)
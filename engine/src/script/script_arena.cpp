@@ -0,0 +1,69 @@
+#include "script_arena.hpp"
+#include <algorithm>
+
+GuestString ArgumentArena::intern(machine_t& machine, std::string_view str)
+{
+	auto it = m_interned.find(str);
+	if (it != m_interned.end())
+		return it->second;
+
+	// Zero-terminated, so that it can be passed as a const char*
+	const size_t bytes = str.size() + 1;
+	gaddr_t address;
+	if (bytes > CHUNK_SIZE / 4)
+	{
+		// Long strings get their own allocation
+		address = machine.arena().malloc(bytes);
+	}
+	else
+	{
+		if (m_chunk_used + bytes > CHUNK_SIZE)
+		{
+			m_chunk = machine.arena().malloc(CHUNK_SIZE);
+			m_chunk_used = 0;
+		}
+		address = (m_chunk != 0x0) ? m_chunk + m_chunk_used : 0x0;
+		m_chunk_used += bytes;
+	}
+	if (address == 0x0)
+		throw std::runtime_error("ArgumentArena: Out of memory interning a string");
+	machine.memory.memcpy(address, str.data(), str.size());
+	machine.memory.write<uint8_t>(address + str.size(), 0);
+
+	const GuestString result {address, uint32_t(str.size())};
+	m_interned.emplace(str, result);
+	return result;
+}
+
+ArgumentArena::gaddr_t ArgumentArena::place_bytes(machine_t& machine,
+	const void* data, size_t size, size_t align)
+{
+	if (m_frame == 0x0)
+	{
+		m_frame = machine.arena().malloc(FRAME_SIZE);
+		if (m_frame == 0x0)
+			throw std::runtime_error("ArgumentArena: Out of memory for the frame");
+	}
+	const size_t offset = (m_frame_used + align - 1) & ~(align - 1);
+	if (offset + size > FRAME_SIZE)
+		throw std::runtime_error("ArgumentArena: Too many arguments placed in one frame");
+	machine.memory.memcpy(m_frame + offset, data, size);
+	m_frame_used = offset + size;
+	return m_frame + offset;
+}
+
+ArgumentArena::gaddr_t ArgumentArena::batch(machine_t& machine, size_t bytes)
+{
+	if (bytes > m_batch_size)
+	{
+		if (m_batch != 0x0)
+			machine.arena().free(m_batch);
+		// Round up, so that slowly growing batches rarely reallocate
+		const size_t size = std::max(bytes, 2 * m_batch_size);
+		m_batch = machine.arena().malloc(size);
+		m_batch_size = (m_batch != 0x0) ? size : 0;
+		if (m_batch == 0x0)
+			throw std::runtime_error("ArgumentArena: Out of memory for the batch");
+	}
+	return m_batch;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include "program_cache.hpp"
+
+/// @brief A string in guest memory, passed to the guest as a const char*
+struct GuestString
+{
+	Program::gaddr_t address;
+	uint32_t size;
+};
+
+/// @brief An object in guest memory, passed to the guest by reference
+template <typename T>
+struct GuestRef
+{
+	Program::gaddr_t address;
+};
+
+/// @brief Arguments in guest memory that are placed once, and then passed
+/// by address, instead of being copied onto the guest stack on every call.
+/// - Interned strings stay for the lifetime of the arena, and repeated
+///   strings, such as event and entity names, are only copied once.
+/// - Placed objects belong to the current frame, and are forgotten by
+///   reset_frame(), which should be called at frame boundaries.
+/// The guest must treat the arguments as read-only.
+struct ArgumentArena
+{
+	using gaddr_t	= Program::gaddr_t;
+	using machine_t = Program::machine_t;
+	/// @brief Interned strings are allocated in chunks of this size
+	static constexpr size_t CHUNK_SIZE = 4096;
+	/// @brief The max total size of the objects placed during a frame
+	static constexpr size_t FRAME_SIZE = 65536;
+
+	/// @brief Copy a string into guest memory, unless it already is.
+	/// @param machine The machine the arena lives in.
+	/// @param str The string to intern.
+	/// @return The zero-terminated string in guest memory.
+	GuestString intern(machine_t& machine, std::string_view str);
+
+	/// @brief Copy an object into the guest memory of the current frame.
+	/// @param machine The machine the arena lives in.
+	/// @param object The object to place. Must be trivially copyable.
+	/// @return A reference to the object in guest memory.
+	template <typename T>
+	GuestRef<T> place(machine_t& machine, const T& object);
+
+	/// @brief Forget every object placed during the current frame.
+	void reset_frame() noexcept { m_frame_used = 0; }
+
+	/// @brief Guest memory for the records of a batch call, which is
+	/// reused by every batch and only grows when a batch is larger.
+	/// @param machine The machine the arena lives in.
+	/// @param bytes The size of the records.
+	/// @return The records area, only valid until the next batch.
+	gaddr_t batch(machine_t& machine, size_t bytes);
+
+	/// @brief The number of interned strings.
+	size_t interned() const noexcept { return m_interned.size(); }
+	/// @brief The number of bytes placed during the current frame.
+	size_t frame_used() const noexcept { return m_frame_used; }
+
+  private:
+	gaddr_t place_bytes(machine_t&, const void* data, size_t size, size_t align);
+
+	std::unordered_map<std::string, GuestString, string_hash, strhash_equal> m_interned;
+	gaddr_t m_chunk = 0x0;
+	size_t m_chunk_used = CHUNK_SIZE;
+	gaddr_t m_frame = 0x0;
+	size_t m_frame_used = 0;
+	gaddr_t m_batch = 0x0;
+	size_t m_batch_size = 0;
+};
+
+template <typename T>
+inline GuestRef<T> ArgumentArena::place(machine_t& machine, const T& object)
+{
+	static_assert(std::is_trivially_copyable_v<T>, "Placed objects must be trivially copyable");
+	return {this->place_bytes(machine, &object, sizeof(T), alignof(T))};
+}
+
+template <typename T> struct is_guest_ref : std::false_type {};
+template <typename T> struct is_guest_ref<GuestRef<T>> : std::true_type {};
+
+/// @brief Arguments from an ArgumentArena are passed as guest addresses,
+/// while every other argument is passed along as-is.
+template <typename T>
+inline decltype(auto) guest_argument(T&& arg)
+{
+	using U = std::decay_t<T>;
+	if constexpr (std::is_same_v<U, GuestString> || is_guest_ref<U>::value)
+		return Program::gaddr_t(arg.address);
+	else
+		return std::forward<T>(arg);
+}
+
+/// @brief The type a guest argument stands in for, when type-checking calls
+template <typename T> struct GuestArgumentType { using type = T; };
+template <> struct GuestArgumentType<GuestString> { using type = const char*; };
+template <typename T> struct GuestArgumentType<GuestRef<T>> { using type = const T&; };
+template <typename T>
+using guest_argument_t = std::conditional_t<
+	std::is_same_v<std::decay_t<T>, GuestString> || is_guest_ref<std::decay_t<T>>::value,
+	typename GuestArgumentType<std::decay_t<T>>::type, T>;
@@ -1,14 +1,19 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
-#include <string>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
 
-enum class ArgType : int
+enum class ArgType : uint8_t
 {
 	INT64,
 	FLOAT32,
 	STRING
 };
 
+/// @brief A single dynamic argument. Strings are views into guest memory,
+/// so the argument is trivially copyable and never needs destruction.
 struct ScriptArg
 {
 	bool is_int64() const noexcept
@@ -26,40 +31,83 @@ struct ScriptArg
 		return type == ArgType::STRING;
 	}
 
-	ScriptArg(int64_t value)
+	/// @brief Retrieve the value as the given type, which must be one of
+	/// int64_t, float or std::string_view and match the argument type.
+	template <typename T>
+	T get() const
 	{
-		this->i64  = value;
-		this->type = ArgType::INT64;
+		if constexpr (std::is_same_v<T, int64_t>) {
+			if (is_int64()) return i64;
+		} else if constexpr (std::is_same_v<T, float>) {
+			if (is_float32()) return f32;
+		} else if constexpr (std::is_same_v<T, std::string_view>) {
+			if (is_string()) return string;
+		} else {
+			static_assert(!sizeof(T), "Dynamic arguments are int64_t, float or std::string_view");
+		}
+		throw std::runtime_error("Dynamic args: Argument has another type");
 	}
 
-	ScriptArg(float value)
-	{
-		this->f32  = value;
-		this->type = ArgType::FLOAT32;
-	}
-
-	ScriptArg(std::string value)
-	{
-		this->string = std::move(value);
-		this->type	 = ArgType::STRING;
-	}
-
-	~ScriptArg();
+	constexpr ScriptArg() noexcept : i64(0), type(ArgType::INT64) {}
+	constexpr ScriptArg(int64_t value) noexcept : i64(value), type(ArgType::INT64) {}
+	constexpr ScriptArg(float value) noexcept : f32(value), type(ArgType::FLOAT32) {}
+	constexpr ScriptArg(std::string_view value) noexcept : string(value), type(ArgType::STRING) {}
 
 	union
 	{
 		int64_t i64;
 		float f32;
-		std::string string;
+		/// @brief Only valid for the duration of the dynamic call
+		std::string_view string;
 	};
 	enum ArgType type;
 };
+static_assert(std::is_trivially_copyable_v<ScriptArg> && std::is_trivially_destructible_v<ScriptArg>);
 
-inline ScriptArg::~ScriptArg()
+/// @brief The arguments of a dynamic argument call, stored inline without
+/// any heap allocations. Cleared after each call, without running destructors.
+struct ScriptArgs
 {
-	switch (type)
+	static constexpr size_t CAPACITY = 16;
+
+	size_t size() const noexcept { return m_size; }
+	bool empty() const noexcept { return m_size == 0; }
+	void clear() noexcept { m_size = 0; }
+
+	const ScriptArg& operator[](size_t i) const noexcept { return m_args[i]; }
+	const ScriptArg& at(size_t i) const
 	{
-	case ArgType::STRING: string.~basic_string(); break;
-	default: break;
+		if (i < m_size)
+			return m_args[i];
+		throw std::out_of_range("Dynamic args: Argument index out of range");
 	}
-}
+	/// @brief Retrieve the typed value of an argument, eg. args.get<float>(1)
+	template <typename T>
+	T get(size_t i) const { return at(i).get<T>(); }
+
+	const ScriptArg* begin() const noexcept { return &m_args[0]; }
+	const ScriptArg* end() const noexcept { return &m_args[m_size]; }
+
+	/// @brief Clears the arguments when the dynamic call is over,
+	/// including when the handler throws
+	struct CallScope {
+		CallScope(ScriptArgs& args) noexcept : args(args) {}
+		~CallScope() { args.clear(); }
+		ScriptArgs& args;
+	};
+
+	void push_back(ScriptArg arg)
+	{
+		if (m_size < CAPACITY) {
+			m_args[m_size++] = arg;
+			return;
+		}
+		// The call is never made, so the next one starts over
+		this->clear();
+		throw std::runtime_error("Dynamic args: Too many arguments");
+	}
+
+  private:
+	ScriptArg m_args[CAPACITY];
+	size_t m_size = 0;
+};
@@ -1,5 +1,9 @@
 #include "script.hpp"
+#include "script_pool.hpp"
+#include <deque>
+#include <libriscv/util/crc32.hpp>
 #include <strf/to_cfile.hpp>
+#include <unistd.h>
 #define USE_PREPARED_CALLS 1
 #ifdef USE_PREPARED_CALLS
 #include <libriscv/prepared_call.hpp>
@@ -98,6 +102,178 @@ long Script::benchmark(std::function<void()> callback, size_t TIMES)
 	return finish_benchmark(results);
 }
 
+static size_t resident_memory(bool anonymous_only = false)
+{
+	long pages = 0, resident = 0, shared = 0;
+	FILE* f = fopen("/proc/self/statm", "r");
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%ld %ld %ld", &pages, &resident, &shared) != 3)
+		resident = shared = 0;
+	fclose(f);
+	// File-backed pages are shared with the page cache
+	if (anonymous_only)
+		resident -= shared;
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+void Script::clone_benchmark(size_t instances)
+{
+	if (this->m_snapshot == nullptr)
+		throw std::runtime_error(this->name() + ": Clone benchmark requires a snapshot");
+
+	for (const auto mode : {CloneMode::Private, CloneMode::CopyOnWrite})
+	{
+		// Script is not movable, but a deque constructs in-place
+		std::deque<Script> clones;
+		const size_t rss_before = resident_memory();
+		const auto t0 = time_now();
+		for (size_t i = 0; i < instances; i++)
+			clones.emplace_back(this->m_snapshot, this->name(), this->m_userptr, mode);
+		const auto t1 = time_now();
+		// RSS can shrink when the allocator returns memory to the system
+		const size_t rss_after = std::max(rss_before, resident_memory());
+
+		const size_t per_instance = std::max(size_t(1),
+			(rss_after - rss_before) / std::max(size_t(1), instances));
+		strf::to(stdout)(
+			"> ", (mode == CloneMode::Private) ? "Private" : "Copy-on-write",
+			" clones: ", per_instance / 1024, " KiB per instance, ",
+			(1ull << 30) / per_instance, " instances per GB, ",
+			nanodiff(t0, t1) / std::max(size_t(1), instances), "ns per clone\n");
+	}
+}
+
+void Script::load_benchmark(size_t instances)
+{
+	for (const auto storage : {Program::Storage::Heap, Program::Storage::Mapped})
+	{
+		// Bypass the program cache, so that every instance loads anew
+		std::vector<std::shared_ptr<const Program>> programs;
+		std::vector<std::unique_ptr<machine_t>> machines;
+		const size_t rss_before = resident_memory(true);
+		const auto t0 = time_now();
+		for (size_t i = 0; i < instances; i++)
+		{
+			auto& program = programs.emplace_back(Program::open(filename(), storage));
+			machines.push_back(std::make_unique<machine_t>(program->binary(), machine_options()));
+		}
+		const auto t1 = time_now();
+		const size_t rss_after = std::max(rss_before, resident_memory(true));
+
+		strf::to(stdout)(
+			"> ", (storage == Program::Storage::Heap) ? "Heap" : "Mapped",
+			" programs: ", (rss_after - rss_before) / std::max(size_t(1), instances) / 1024,
+			" KiB private memory per instance, ",
+			nanodiff(t0, t1) / std::max(size_t(1), instances), "ns per load\n");
+	}
+}
+
+void Script::pool_benchmark(size_t rounds)
+{
+	rounds = std::max(size_t(1), rounds);
+	// Every new instance reports that it has been initialized
+	FILE* devnull = fopen("/dev/null", "w");
+	Script::set_output(devnull);
+
+	const auto t0 = time_now();
+	for (size_t i = 0; i < rounds; i++)
+	{
+		Script script {m_program, name(), filename(), is_debug(), m_userptr};
+	}
+	const auto t1 = time_now();
+
+	ScriptPool pool(m_program, name(), filename(), 4, is_debug(), m_userptr);
+	const auto t2 = time_now();
+	for (size_t i = 0; i < rounds; i++)
+	{
+		auto lease = pool.acquire();
+	}
+	const auto t3 = time_now();
+	// For comparing calls into an instance with a memory arena
+	Script plain {m_program, name(), filename(), is_debug(), m_userptr};
+
+	Script::set_output(nullptr);
+	if (devnull != nullptr)
+		fclose(devnull);
+
+	const auto stats = pool.stats();
+	strf::to(stdout)(
+		"> New instance: ", nanodiff(t0, t1) / rounds, "ns, ",
+		"pooled instance: ", nanodiff(t2, t3) / rounds, "ns (",
+		stats.instances, " instances, high-water mark: ", stats.high_water, ")\n");
+
+	// Pooled instances are checkpointed, and access memory through pages
+	const auto func = address_of("touch_memory");
+	if (func == 0x0)
+		return;
+	auto lease = pool.acquire();
+	auto time_calls = [&] (Script& script) {
+		script.call(func); // warmup
+		const auto t0 = time_now();
+		for (size_t i = 0; i < rounds; i++)
+			script.call(func);
+		return nanodiff(t0, time_now()) / rounds;
+	};
+	strf::to(stdout)(
+		"> Touching 64KB: ", time_calls(plain), "ns with a memory arena, ",
+		time_calls(*lease), "ns checkpointed\n");
+}
+
+void Script::nested_benchmark(gaddr_t address, size_t rounds)
+{
+	rounds = std::max(size_t(1), rounds);
+	riscv::PreparedCall<MARCH, void(int), MAX_CALL_INSTR> pcall(machine(), address);
+	int64_t prepared_ns = 0, preempt_ns = 0;
+	// Both loops call the function with depth 0, so it returns right away
+	auto timed = [&] {
+		this->prepared_call(pcall, 0); // warmup
+		const auto t0 = time_now();
+		for (size_t i = 0; i < rounds; i++)
+			this->prepared_call(pcall, 0);
+		const auto t1 = time_now();
+		// Saving and restoring the whole register file
+		for (size_t i = 0; i < rounds; i++)
+			machine().preempt(MAX_CALL_INSTR, address, 0);
+		const auto t2 = time_now();
+		prepared_ns = nanodiff(t0, t1) / rounds;
+		preempt_ns  = nanodiff(t1, t2) / rounds;
+	};
+
+	// The guest calls back into the host with a depth of 1, and the host
+	// calls the function again, until the timed calls would be made at
+	// the wanted depth. Only the calls at that depth are timed.
+	static constexpr std::string_view nested = "Test::nested";
+	const uint32_t hash = riscv::crc32(nested.data(), nested.size());
+	const HostDyncall* previous = m_dynamic_functions.find(hash);
+	unsigned wanted_depth = 1;
+	Script::set_dynamic_call(std::string(nested), [&] (Script& script) {
+		script.dynargs().clear();
+		if (script.m_call_depth + 1u < wanted_depth)
+			script.call(address, 1);
+		else
+			timed();
+	});
+	for (const unsigned depth : {1u, 2u, 4u})
+	{
+		wanted_depth = depth;
+		if (depth == 1)
+			timed();
+		else
+			this->call(address, 1);
+		strf::to(stdout)(
+			"> Nested at depth ", depth, ": prepared_call() ", prepared_ns,
+			"ns, machine_t::preempt() ", preempt_ns, "ns\n");
+	}
+
+	// The handler refers to this stack frame
+	if (previous != nullptr)
+		register_dynamic_call(hash, previous->name, previous->definition,
+			previous->func, previous->handler);
+	else
+		Script::set_dynamic_call(std::string(nested), nullptr);
+}
+
 long Script::finish_benchmark(std::vector<long>& results)
 {
 	std::sort(results.begin(), results.end());
@@ -0,0 +1,157 @@
+#include "script_faults.hpp"
+
+#include <strf/to_cfile.hpp>
+using namespace std::chrono;
+
+FaultLog::FaultLog(unsigned site_limit, unsigned script_limit)
+  : m_slots(new Slot[CAPACITY]),
+	m_site_limit(site_limit), m_script_limit(script_limit),
+	m_window(steady_clock::now())
+{
+	for (size_t i = 0; i < CAPACITY; i++)
+		m_slots[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+FaultLog::~FaultLog()
+{
+	this->stop();
+}
+
+bool FaultLog::record(const FaultRecord& record) noexcept
+{
+	// Bounded multi-producer queue: Each slot has a sequence number that
+	// tells whether it is free for the producer claiming that position
+	size_t pos = m_enqueue.load(std::memory_order_relaxed);
+	Slot* slot;
+	while (true)
+	{
+		slot = &m_slots[pos & MASK];
+		const size_t seq = slot->sequence.load(std::memory_order_acquire);
+		const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+		if (diff == 0)
+		{
+			if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+		{
+			// Full: The consumer has not caught up
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		else
+		{
+			pos = m_enqueue.load(std::memory_order_relaxed);
+		}
+	}
+	slot->record = record;
+	slot->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+bool FaultLog::pop(FaultRecord& record)
+{
+	// Single consumer, under m_consumer_mtx
+	const size_t pos = m_dequeue.load(std::memory_order_relaxed);
+	auto& slot = m_slots[pos & MASK];
+	const size_t seq = slot.sequence.load(std::memory_order_acquire);
+	if (intptr_t(seq) - intptr_t(pos + 1) < 0)
+		return false;
+	record = std::move(slot.record);
+	slot.sequence.store(pos + CAPACITY, std::memory_order_release);
+	m_dequeue.store(pos + 1, std::memory_order_relaxed);
+	return true;
+}
+
+bool FaultLog::allowed(const FaultRecord& record)
+{
+	const uint64_t site = (uint64_t(record.script_hash) << 32) ^ uint64_t(record.pc);
+	// Faults suppressed per site do not count towards the script limit
+	if (++m_site_counts[site] <= m_site_limit
+		&& ++m_script_counts[record.script_hash] <= m_script_limit)
+		return true;
+	m_window_suppressed++;
+	m_suppressed++;
+	return false;
+}
+
+size_t FaultLog::drain(FILE* out)
+{
+	std::scoped_lock lock(m_consumer_mtx);
+	// Rate limits apply to windows of one second
+	const auto now = steady_clock::now();
+	if (now - m_window >= seconds(1))
+	{
+		if (m_window_suppressed > 0)
+			strf::to(out)("FaultLog: ", m_window_suppressed,
+				" fault reports suppressed\n");
+		m_site_counts.clear();
+		m_script_counts.clear();
+		m_window_suppressed = 0;
+		m_window = now;
+	}
+
+	FaultRecord record;
+	size_t count = 0;
+	while (this->pop(record))
+	{
+		if (this->allowed(record))
+			print(record, out);
+		count++;
+	}
+	return count;
+}
+
+void FaultLog::start(FILE* out, milliseconds interval)
+{
+	if (m_running.exchange(true))
+		return;
+	m_consumer = std::thread([this, out, interval] {
+		while (m_running.load(std::memory_order_relaxed))
+		{
+			this->drain(out);
+			std::this_thread::sleep_for(interval);
+		}
+		this->drain(out);
+	});
+}
+
+void FaultLog::stop()
+{
+	m_running.store(false);
+	if (m_consumer.joinable())
+		m_consumer.join();
+}
+
+void FaultLog::print(const FaultRecord& record, FILE* out)
+{
+	auto program = record.program.lock();
+	auto print_frame = [&](const char* prefix, Program::gaddr_t address) {
+		if (program != nullptr)
+		{
+			const auto frame = program->lookup(address);
+			strf::to(out)(prefix, strf::hex(frame.address), " + ",
+				strf::hex(frame.offset), ": ", frame.name, "\n");
+		}
+		else
+		{
+			strf::to(out)(prefix, strf::hex(address), "\n");
+		}
+	};
+
+	switch (record.type)
+	{
+	case FaultRecord::Type::Timeout:
+		strf::to(out)("[", record.script_name, "] Max instructions\n");
+		break;
+	case FaultRecord::Type::Machine:
+		strf::to(out)("[", record.script_name, "] Exception: ", record.message,
+			"  (type: ", record.exception_type, ", data: ", strf::hex(record.data), ")\n");
+		break;
+	default:
+		strf::to(out)("[", record.script_name, "] Message: ", record.message, "\n");
+	}
+	print_frame("-> [0] ", record.pc);
+	print_frame("-> [1] ", record.ra);
+	print_frame("-> [-] ", record.address);
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "program_cache.hpp"
+
+/// @brief A compact record of a fault in a script. Recording one does
+/// not allocate, and does not symbolize or print anything.
+struct FaultRecord
+{
+	using gaddr_t = Program::gaddr_t;
+	enum class Type : uint8_t {
+		/// @brief The call ran out of instructions
+		Timeout,
+		/// @brief An exception raised by the virtual machine
+		Machine,
+		/// @brief Any other exception, eg. thrown by a host function
+		Other,
+	};
+	static constexpr size_t MAX_NAME = 32;
+	static constexpr size_t MAX_MESSAGE = 64;
+
+	Type type = Type::Other;
+	/// @brief The libriscv exception type, for Machine faults
+	int exception_type = 0;
+	uint64_t data = 0;
+	/// @brief The hash of the name of the Script
+	uint32_t script_hash = 0;
+	/// @brief The function that was called from the host
+	gaddr_t address = 0x0;
+	gaddr_t pc = 0x0;
+	gaddr_t ra = 0x0;
+	/// @brief For symbolizing the addresses, if the program still exists
+	std::weak_ptr<const Program> program;
+	char script_name[MAX_NAME] {};
+	char message[MAX_MESSAGE] {};
+};
+
+/// @brief Collects fault records from any thread into a fixed-size,
+/// lock-free ring buffer. A single consumer symbolizes and prints them
+/// later, either from a background thread or by calling drain().
+/// Printing is rate limited per script and per fault site (script and PC),
+/// so that a script that faults every frame cannot flood the output.
+/// @example
+/// static FaultLog faults;
+/// faults.start(stdout);
+/// Script::set_fault_log(&faults);
+struct FaultLog
+{
+	static constexpr size_t CAPACITY = 256;
+
+	/// @param site_limit The max faults printed per second for each fault site.
+	/// @param script_limit The max faults printed per second for each script.
+	FaultLog(unsigned site_limit = 2, unsigned script_limit = 8);
+	~FaultLog();
+
+	/// @brief Add a fault record to the ring buffer. Never blocks, and
+	/// drops the record if the buffer is full.
+	/// @return False if the record was dropped.
+	bool record(const FaultRecord&) noexcept;
+
+	/// @brief Take every fault record out of the ring buffer, and pass
+	/// them to the callback one by one, without any rate limiting.
+	/// @return The number of records consumed.
+	template <typename F>
+	size_t consume(F&& callback);
+
+	/// @brief Symbolize and print every fault record in the ring buffer.
+	/// @param out Where to print the faults.
+	/// @return The number of records consumed, including suppressed ones.
+	size_t drain(FILE* out);
+
+	/// @brief Start a background thread that drains the ring buffer.
+	/// @param out Where to print the faults.
+	/// @param interval How often the ring buffer is drained.
+	void start(FILE* out, std::chrono::milliseconds interval = std::chrono::milliseconds(50));
+	/// @brief Stop the background thread, after draining what is left.
+	void stop();
+
+	/// @brief Records dropped because the ring buffer was full.
+	uint64_t dropped() const noexcept { return m_dropped.load(std::memory_order_relaxed); }
+	/// @brief Records consumed, but not printed due to rate limiting.
+	uint64_t suppressed() const noexcept { return m_suppressed; }
+
+	/// @brief Symbolize and print a single fault record.
+	static void print(const FaultRecord&, FILE* out);
+
+  private:
+	bool pop(FaultRecord&);
+	bool allowed(const FaultRecord&);
+
+	static constexpr size_t MASK = CAPACITY - 1;
+	static_assert((CAPACITY & MASK) == 0, "Capacity must be a power of two");
+	struct Slot {
+		std::atomic<size_t> sequence;
+		FaultRecord record;
+	};
+	std::unique_ptr<Slot[]> m_slots;
+	alignas(64) std::atomic<size_t> m_enqueue = 0;
+	alignas(64) std::atomic<size_t> m_dequeue = 0;
+	std::atomic<uint64_t> m_dropped = 0;
+
+	// Consumer-side, protected by m_consumer_mtx
+	std::mutex m_consumer_mtx;
+	const unsigned m_site_limit;
+	const unsigned m_script_limit;
+	std::chrono::steady_clock::time_point m_window;
+	std::unordered_map<uint64_t, unsigned> m_site_counts;
+	std::unordered_map<uint32_t, unsigned> m_script_counts;
+	uint64_t m_window_suppressed = 0;
+	uint64_t m_suppressed = 0;
+
+	std::thread m_consumer;
+	std::atomic<bool> m_running = false;
+};
+
+template <typename F>
+inline size_t FaultLog::consume(F&& callback)
+{
+	std::scoped_lock lock(m_consumer_mtx);
+	FaultRecord record;
+	size_t count = 0;
+	while (this->pop(record))
+	{
+		callback(record);
+		count++;
+	}
+	return count;
+}
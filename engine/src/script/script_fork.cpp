@@ -9,9 +9,17 @@ Script& Script::create_fork()
 	// Create thread-local fork on-demand
 	if (UNLIKELY(it == forks.end()))
 	{
+		// Forking a snapshot avoids running through initialization again
+		if (this->m_snapshot != nullptr)
+		{
+			auto fit = forks.emplace(std::piecewise_construct,
+				std::forward_as_tuple(this->m_hash),
+				std::forward_as_tuple(this->m_snapshot, this->m_name, this->m_userptr));
+			return fit.first->second;
+		}
 		auto fit = forks.emplace(std::piecewise_construct,
 			std::forward_as_tuple(this->m_hash),
-			std::forward_as_tuple(this->m_binary, this->m_name, this->m_filename, this->m_is_debug, this->m_userptr));
+			std::forward_as_tuple(this->m_program, this->m_name, this->m_filename, this->m_is_debug, this->m_userptr));
 		return fit.first->second;
 	}
 	// Return forked program
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+/// @brief A handle to a function in a Script program, by name. The name is
+/// hashed when the handle is created, which is at compile-time when using
+/// the _fn literal. The handle is resolved using the hashed symbol index of
+/// each program, and so it can be used with every instance of every program.
+/// @example
+/// static constexpr auto on_tick = "on_tick"_fn;
+/// script.call(on_tick, dt);
+struct ScriptFunction
+{
+	constexpr explicit ScriptFunction(std::string_view name)
+		: m_name(name), m_hash(hash_of(name)) {}
+
+	constexpr std::string_view name() const noexcept { return m_name; }
+	constexpr uint32_t hash() const noexcept { return m_hash; }
+
+	/// @brief CRC32 of a symbol name, the same as riscv::crc32().
+	static constexpr uint32_t hash_of(std::string_view name) noexcept
+	{
+		uint32_t crc = 0xFFFFFFFF;
+		for (const char c : name)
+		{
+			crc ^= uint8_t(c);
+			for (int i = 0; i < 8; i++)
+				crc = (crc >> 1) ^ (0xEDB88320 & (0u - (crc & 1)));
+		}
+		return ~crc;
+	}
+
+  private:
+	std::string_view m_name;
+	uint32_t m_hash;
+};
+
+constexpr ScriptFunction operator""_fn(const char* name, size_t len)
+{
+	return ScriptFunction {std::string_view(name, len)};
+}
@@ -0,0 +1,87 @@
+#include "script_loader.hpp"
+
+#include <atomic>
+#include <exception>
+#include <thread>
+
+ScriptLoader& ScriptLoader::add(const std::string& name,
+	const std::string& filename, bool debug, void* userptr)
+{
+	m_entries.push_back(Entry {name, filename, nullptr, debug, userptr});
+	return *this;
+}
+
+ScriptLoader& ScriptLoader::add(std::shared_ptr<const Program> program,
+	const std::string& name, const std::string& filename, bool debug, void* userptr)
+{
+	m_entries.push_back(Entry {name, filename, std::move(program), debug, userptr});
+	return *this;
+}
+
+std::vector<std::unique_ptr<Script>> ScriptLoader::load(unsigned threads)
+{
+	struct Result {
+		std::unique_ptr<Script> script;
+		std::exception_ptr exception;
+		char*  output = nullptr;
+		size_t output_size = 0;
+	};
+	std::vector<Result> results (m_entries.size());
+	std::atomic<size_t> next = 0;
+
+	auto worker = [&] {
+		for (size_t i = next++; i < m_entries.size(); i = next++)
+		{
+			auto& entry  = m_entries[i];
+			auto& result = results[i];
+			// Capture all output from the boot, to be printed in order later
+			FILE* capture = open_memstream(&result.output, &result.output_size);
+			Script::set_output(capture);
+			try {
+				if (entry.program != nullptr)
+					result.script = std::make_unique<Script>(entry.program,
+						entry.name, entry.filename, entry.debug, entry.userptr);
+				else
+					result.script = std::make_unique<Script>(
+						entry.name, entry.filename, entry.debug, entry.userptr);
+			} catch (...) {
+				result.exception = std::current_exception();
+			}
+			Script::set_output(nullptr);
+			if (capture != nullptr)
+				fclose(capture);
+		}
+	};
+
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(threads, unsigned(m_entries.size()));
+
+	// The calling thread is also a worker
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < threads; i++)
+		workers.emplace_back(worker);
+	worker();
+	for (auto& thread : workers)
+		thread.join();
+
+	std::vector<std::unique_ptr<Script>> scripts;
+	std::exception_ptr first_exception = nullptr;
+	for (auto& result : results)
+	{
+		if (result.output != nullptr)
+		{
+			fwrite(result.output, 1, result.output_size, Script::output());
+			free(result.output);
+		}
+		if (result.exception && !first_exception)
+			first_exception = result.exception;
+		scripts.push_back(std::move(result.script));
+	}
+	fflush(Script::output());
+	m_entries.clear();
+
+	if (first_exception)
+		std::rethrow_exception(first_exception);
+	return scripts;
+}
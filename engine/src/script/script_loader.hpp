@@ -0,0 +1,43 @@
+#pragma once
+#include "script.hpp"
+
+/// @brief Boots many Script instances in parallel on worker threads.
+/// The programs must not depend on each other during initialization.
+/// Output from each boot is captured, and printed in the order the
+/// scripts were added, so that it stays attributable to each script.
+/// @example
+/// ScriptLoader loader;
+/// loader.add("level1", "scripts/level1.elf");
+/// loader.add("level2", "scripts/level2.elf");
+/// auto scripts = loader.load();
+/// Script& level1 = *scripts[0];
+struct ScriptLoader
+{
+	struct Entry {
+		std::string name;
+		std::string filename;
+		/// @brief Use this program instead of loading filename
+		std::shared_ptr<const Program> program = nullptr;
+		bool debug = false;
+		void* userptr = nullptr;
+	};
+
+	/// @brief Add a Script to be created from a program file.
+	ScriptLoader& add(const std::string& name, const std::string& filename,
+		bool debug = false, void* userptr = nullptr);
+	/// @brief Add a Script to be created from an existing program.
+	ScriptLoader& add(std::shared_ptr<const Program> program, const std::string& name,
+		const std::string& filename, bool debug = false, void* userptr = nullptr);
+
+	/// @brief Create and boot all added scripts. If any of them fails, the
+	/// exception of the first failing script (in order) is re-thrown once
+	/// all boots have finished.
+	/// @param threads The max number of worker threads, 0 for one per CPU.
+	/// @return The scripts, in the same order as they were added.
+	std::vector<std::unique_ptr<Script>> load(unsigned threads = 0);
+
+	size_t size() const noexcept { return m_entries.size(); }
+
+  private:
+	std::vector<Entry> m_entries;
+};
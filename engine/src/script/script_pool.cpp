@@ -0,0 +1,75 @@
+#include "script_pool.hpp"
+#include <strf/to_cfile.hpp>
+
+ScriptPool::ScriptPool(std::shared_ptr<const Program> program,
+	const std::string& name, const std::string& filename, size_t instances,
+	bool debug, void* userptr)
+  : m_name(name), m_userptr(userptr)
+{
+	std::scoped_lock lock(m_mtx);
+	// The first instance boots, and the rest are forked from its snapshot
+	auto& first = m_scripts.emplace_back(std::move(program), name, filename, debug, userptr);
+	m_snapshot = first.snapshot();
+	first.checkpoint();
+	m_free.push_back(&first);
+
+	while (m_scripts.size() < instances)
+		m_free.push_back(&this->create_locked());
+	m_stats.instances = m_scripts.size();
+}
+
+Script& ScriptPool::create_locked()
+{
+	auto& script = m_scripts.emplace_back(m_snapshot, m_name, m_userptr);
+	script.checkpoint();
+	return script;
+}
+
+ScriptPool::Lease ScriptPool::acquire()
+{
+	std::scoped_lock lock(m_mtx);
+	Script* script = nullptr;
+	if (LIKELY(!m_free.empty()))
+	{
+		script = m_free.back();
+		m_free.pop_back();
+	}
+	else
+	{
+		script = &this->create_locked();
+		m_stats.instances = m_scripts.size();
+		m_stats.grown++;
+	}
+	m_stats.acquires++;
+	m_stats.in_use++;
+	m_stats.high_water = std::max(m_stats.high_water, m_stats.in_use);
+	return Lease(*this, *script);
+}
+
+void ScriptPool::release(Script& script) noexcept
+{
+	bool recycled = true;
+	try {
+		// Rolling back only touches the pages the lease wrote to
+		script.rollback();
+	} catch (const std::exception& e) {
+		// Eg. released during a call. The instance is never leased
+		// again, and is destroyed together with the pool.
+		strf::to(stderr)("ScriptPool: Discarding '", script.name(),
+			"' instead of recycling it: ", e.what(), "\n");
+		recycled = false;
+	}
+
+	std::scoped_lock lock(m_mtx);
+	if (recycled)
+		m_free.push_back(&script);
+	else
+		m_stats.discarded++;
+	m_stats.in_use--;
+}
+
+ScriptPool::Stats ScriptPool::stats() const
+{
+	std::scoped_lock lock(m_mtx);
+	return m_stats;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include "script.hpp"
+#include <deque>
+#include <mutex>
+
+/// @brief Keeps a number of booted instances of a program around, so that
+/// short-lived Scripts can be leased instead of constructed. Each instance
+/// is checkpointed right after booting, and rolled back in-place when it is
+/// returned, so that its machine and heap arena are reused.
+/// Checkpointed machines have no flat memory arena, and access memory
+/// through pages instead, which makes calls into them somewhat slower.
+/// See: Script::checkpoint() and Script::pool_benchmark()
+/// @example
+/// ScriptPool pool(ProgramCache::load("scripts/mod.elf"), "mod", "scripts/mod.elf", 8);
+/// {
+/// 	auto script = pool.acquire();
+/// 	script->call("on_request");
+/// } // Returned to the pool, without any side effects from the call
+struct ScriptPool
+{
+	/// @brief A leased instance, returned to the pool on destruction.
+	struct Lease
+	{
+		Script& operator*() const noexcept { return *m_script; }
+		Script* operator->() const noexcept { return m_script; }
+
+		Lease(ScriptPool& pool, Script& script) : m_pool(pool), m_script(&script) {}
+		Lease(Lease&& other) noexcept
+		  : m_pool(other.m_pool), m_script(other.m_script)
+		{
+			other.m_script = nullptr;
+		}
+		Lease& operator=(Lease&&) = delete;
+		~Lease()
+		{
+			if (m_script != nullptr)
+				m_pool.release(*m_script);
+		}
+
+	  private:
+		ScriptPool& m_pool;
+		Script* m_script;
+	};
+
+	struct Stats
+	{
+		/// @brief The number of instances owned by the pool
+		size_t instances = 0;
+		/// @brief The number of instances currently leased
+		size_t in_use = 0;
+		/// @brief The highest number of instances leased at the same time
+		size_t high_water = 0;
+		/// @brief The total number of leases
+		uint64_t acquires = 0;
+		/// @brief The number of instances created because the pool was empty
+		uint64_t grown = 0;
+		/// @brief The number of instances that could not be rolled back
+		uint64_t discarded = 0;
+	};
+
+	/// @brief Lease an instance, creating a new one if all are in use.
+	Lease acquire();
+	/// @brief Roll back an instance to its booted state, and return it to
+	/// the pool. Called automatically when a Lease is destroyed.
+	/// An instance that cannot be rolled back is discarded instead.
+	void release(Script&) noexcept;
+
+	Stats stats() const;
+
+	/// @brief Create a pool of booted instances of a program.
+	/// @param instances The number of instances to create up front.
+	ScriptPool(std::shared_ptr<const Program> program, const std::string& name,
+		const std::string& filename, size_t instances,
+		bool debug = false, void* userptr = nullptr);
+
+  private:
+	Script& create_locked();
+
+	mutable std::mutex m_mtx;
+	const std::string m_name;
+	std::shared_ptr<const Script::Snapshot> m_snapshot;
+	/// @brief Script is not movable, but a deque constructs in-place
+	std::deque<Script> m_scripts;
+	std::vector<Script*> m_free;
+	void* m_userptr;
+	Stats m_stats;
+};
@@ -0,0 +1,109 @@
+#include "script.hpp"
+#ifdef DYNCALL_PROFILING
+#include <algorithm>
+#include <strf/to_string.hpp>
+
+struct Script::DyncallProfileRow
+{
+	std::string name;
+	/// @brief The dynamic call table index, or -1 for calls by hash
+	int64_t index;
+	uint32_t hash;
+	const DyncallProfile::Counter* counter;
+};
+
+std::vector<Script::DyncallProfileRow> Script::dyncall_profile_rows() const
+{
+	// A deferred instance has made no calls, and is not booted to find out
+	if (m_machine == nullptr)
+		return {};
+	const auto& table = m_program->dyncall_table(machine()).entries;
+	auto name_of = [&] (uint32_t hash, int64_t index) -> std::string {
+		// The names are in the dynamic call table of the program
+		if (index >= 0 && size_t(index) < table.size())
+			return machine().memory.memstring(table[index].strname);
+		for (const auto& entry : table)
+			if (entry.hash == hash)
+				return machine().memory.memstring(entry.strname);
+		if (const auto* host = m_dynamic_functions.find(hash))
+			return host->name;
+		return "(unknown)";
+	};
+
+	std::vector<DyncallProfileRow> rows;
+	const auto& profile = this->m_dyncall_profile;
+	for (size_t i = 0; i < profile.by_index.size(); i++)
+	{
+		if (profile.by_index[i].calls == 0)
+			continue;
+		const uint32_t hash = (i < table.size()) ? table[i].hash : 0;
+		rows.push_back({name_of(hash, i), int64_t(i), hash, &profile.by_index[i]});
+	}
+	for (const auto& [hash, counter] : profile.by_hash)
+		rows.push_back({name_of(hash, -1), -1, hash, &counter});
+
+	std::sort(rows.begin(), rows.end(),
+		[] (const DyncallProfileRow& a, const DyncallProfileRow& b) {
+			return a.counter->nanos > b.counter->nanos;
+		});
+	return rows;
+}
+
+std::string Script::dyncall_profile_table() const
+{
+	std::string result = strf::to_string(
+		"Dynamic calls made by '", name(), "':\n",
+		strf::right("calls", 12), strf::right("total ns", 14),
+		strf::right("avg ns", 10), strf::right("index", 7), "  name\n");
+	for (const auto& row : dyncall_profile_rows())
+	{
+		const auto& c = *row.counter;
+		result += strf::to_string(
+			strf::right(c.calls, 12), strf::right(c.nanos, 14),
+			strf::right(c.nanos / c.calls, 10));
+		if (row.index >= 0)
+			result += strf::to_string(strf::right(row.index, 7));
+		else
+			result += strf::to_string(strf::right("hash", 7));
+		result += strf::to_string("  ", row.name, "\n");
+	}
+	return result;
+}
+
+static std::string json_escaped(std::string_view str)
+{
+	std::string result;
+	for (const char c : str)
+	{
+		if (c == '"' || c == '\\')
+			result += '\\';
+		result += c;
+	}
+	return result;
+}
+
+std::string Script::dyncall_profile_json() const
+{
+	std::string result = strf::to_string(
+		"{\"name\": \"", json_escaped(name()), "\", \"dyncalls\": [");
+	bool first = true;
+	for (const auto& row : dyncall_profile_rows())
+	{
+		const auto& c = *row.counter;
+		result += strf::to_string(first ? "" : ", ",
+			"{\"name\": \"", json_escaped(row.name), "\", ",
+			"\"index\": ", row.index, ", ",
+			"\"hash\": ", row.hash, ", ",
+			"\"calls\": ", c.calls, ", ",
+			"\"nanos\": ", c.nanos, ", ",
+			"\"histogram\": [");
+		for (unsigned i = 0; i < DyncallProfile::BUCKETS; i++)
+			result += strf::to_string(i ? ", " : "", c.histogram[i]);
+		result += "]}";
+		first = false;
+	}
+	result += "]}";
+	return result;
+}
+
+#endif
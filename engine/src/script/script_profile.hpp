@@ -0,0 +1,55 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Invocation counts and host time of the dynamic calls made by
+/// one Script instance, by dynamic call table index and by hash.
+/// Only collected when built with DYNCALL_PROFILING, and otherwise
+/// the dynamic call paths are unchanged.
+struct DyncallProfile
+{
+	/// @brief Host time histogram buckets, by powers of two nanoseconds.
+	/// The last bucket holds everything above.
+	static constexpr unsigned BUCKETS = 20;
+
+	struct Counter {
+		uint64_t calls = 0;
+		uint64_t nanos = 0;
+		std::array<uint32_t, BUCKETS> histogram {};
+
+		void add(uint64_t ns) noexcept
+		{
+			calls += 1;
+			nanos += ns;
+			unsigned bucket = 0;
+			while (ns > 1 && bucket < BUCKETS - 1) {
+				ns >>= 1;
+				bucket++;
+			}
+			histogram[bucket]++;
+		}
+	};
+
+	void add_index(uint32_t idx, uint64_t ns)
+	{
+		if (idx >= by_index.size())
+			by_index.resize(idx + 1);
+		by_index[idx].add(ns);
+	}
+	void add_hash(uint32_t hash, uint64_t ns)
+	{
+		by_hash[hash].add(ns);
+	}
+	void clear()
+	{
+		by_index.clear();
+		by_hash.clear();
+	}
+
+	/// @brief Dynamic calls through the programs dynamic call table
+	std::vector<Counter> by_index;
+	/// @brief Dynamic calls by hash, eg. with dynamic arguments
+	std::unordered_map<uint32_t, Counter> by_hash;
+};
@@ -0,0 +1,123 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// @brief A registry of entries keyed by 32-bit hashes, such as the CRC32
+/// of dynamic call definitions. The hashes are already well-distributed,
+/// so they index an open-addressing table directly, using linear probing.
+/// Lookups are lock-free, while registration is serialized by a mutex.
+/// Entries and tables are never freed before the registry, so a reader
+/// may keep using what it found while an entry is replaced or the table
+/// grows.
+template <typename T>
+struct HashRegistry
+{
+	HashRegistry() { publish_table(INITIAL_SIZE); }
+
+	/// @brief Find the entry with the given hash, without locking.
+	/// @return The entry, or nullptr if there is none.
+	const T* find(uint32_t hash) const noexcept
+	{
+		const Table* table = m_table.load(std::memory_order_acquire);
+		for (uint32_t i = hash;; i++)
+		{
+			const Slot& slot = table->slots[i & table->mask];
+			const T* entry = slot.entry.load(std::memory_order_acquire);
+			// The table is never more than half full
+			if (entry == nullptr)
+				return nullptr;
+			if (slot.hash.load(std::memory_order_relaxed) == hash)
+				return entry;
+		}
+	}
+
+	/// @brief Create or replace the entry with the given hash.
+	/// @param make Called with the current entry (or nullptr) while holding
+	/// the registration lock, and returns the new entry. It may throw.
+	/// @return The new entry, which readers see from now on.
+	template <typename F>
+	const T* update(uint32_t hash, F&& make)
+	{
+		std::scoped_lock lock(m_mutex);
+		Slot* slot = probe(*m_tables.back(), hash);
+		std::unique_ptr<T> entry = make(slot->entry.load(std::memory_order_relaxed));
+		const T* result = entry.get();
+
+		if (slot->entry.load(std::memory_order_relaxed) == nullptr)
+		{
+			if ((m_count + 1) * 2 > m_tables.back()->mask + 1) {
+				publish_table((m_tables.back()->mask + 1) * 2);
+				slot = probe(*m_tables.back(), hash);
+			}
+			slot->hash.store(hash, std::memory_order_relaxed);
+			m_count++;
+		}
+		// Previous entries may still be in use, and are kept alive
+		m_entries.push_back(std::move(entry));
+		slot->entry.store(result, std::memory_order_release);
+		m_epoch.fetch_add(1, std::memory_order_release);
+		return result;
+	}
+
+	/// @brief Incremented by every update, including replacements, so that
+	/// anything derived from the registry can tell when it is out of date.
+	/// Whether to derive it again is up to the reader.
+	uint64_t epoch() const noexcept { return m_epoch.load(std::memory_order_acquire); }
+
+  private:
+	static constexpr uint32_t INITIAL_SIZE = 256;
+	struct Slot {
+		std::atomic<uint32_t> hash {0};
+		std::atomic<const T*> entry {nullptr};
+	};
+	struct Table {
+		Table(uint32_t size) : mask(size - 1), slots(new Slot[size]) {}
+		const uint32_t mask;
+		const std::unique_ptr<Slot[]> slots;
+	};
+
+	/// @brief The slot holding the hash, or the empty slot where it belongs
+	static Slot* probe(Table& table, uint32_t hash) noexcept
+	{
+		for (uint32_t i = hash;; i++)
+		{
+			Slot& slot = table.slots[i & table.mask];
+			if (slot.entry.load(std::memory_order_relaxed) == nullptr
+				|| slot.hash.load(std::memory_order_relaxed) == hash)
+				return &slot;
+		}
+	}
+
+	/// @brief Rehash every entry into a new table and make it visible to readers
+	void publish_table(uint32_t size)
+	{
+		auto table = std::make_unique<Table>(size);
+		if (!m_tables.empty())
+		{
+			const Table& old = *m_tables.back();
+			for (uint32_t i = 0; i <= old.mask; i++)
+			{
+				const T* entry = old.slots[i].entry.load(std::memory_order_relaxed);
+				if (entry == nullptr)
+					continue;
+				const uint32_t hash = old.slots[i].hash.load(std::memory_order_relaxed);
+				Slot* slot = probe(*table, hash);
+				slot->hash.store(hash, std::memory_order_relaxed);
+				slot->entry.store(entry, std::memory_order_relaxed);
+			}
+		}
+		m_table.store(table.get(), std::memory_order_release);
+		m_tables.push_back(std::move(table));
+	}
+
+	std::atomic<const Table*> m_table {nullptr};
+	std::atomic<uint64_t> m_epoch {0};
+	size_t m_count = 0;
+	std::mutex m_mutex;
+	/// @brief The current table is the last one
+	std::vector<std::unique_ptr<Table>> m_tables;
+	std::vector<std::unique_ptr<T>> m_entries;
+};
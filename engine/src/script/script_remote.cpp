@@ -1,5 +1,6 @@
 #include "script.hpp"
 
+#include <cstring>
 #include <libriscv/native_heap.hpp>
 #include <stdexcept>
 
@@ -46,6 +47,8 @@ void Script::machine_remote_setup()
 					}
 					else if (mem.pages_active() < pages_max)
 					{
+						if (auto* cow = this->cow_page_fault(mem, page))
+							return *cow;
 						return mem.allocate_page(
 							page, init ? riscv::PageData::INITIALIZED
 									   : riscv::PageData::UNINITIALIZED);
@@ -75,12 +78,33 @@ void Script::machine_remote_setup()
 					return m_remote_script->machine().memory.get_pageno(
 						pageno);
 				}
+				if (auto* cow = this->cow_page_read(pageno))
+					return *cow;
 
 				return riscv::Memory<MARCH>::default_page_read(mem, pageno);
 			});
 	} // level machine
 	else
 	{ // shared machine
+		if (this->m_cow_source != nullptr)
+		{
+			machine().memory.set_page_fault_handler(
+				[this](auto& mem, const auto page, bool init) -> riscv::Page&
+				{
+					if (auto* cow = this->cow_page_fault(mem, page))
+						return *cow;
+					return mem.allocate_page(
+						page, init ? riscv::PageData::INITIALIZED
+								   : riscv::PageData::UNINITIALIZED);
+				});
+			machine().memory.set_page_readf_handler(
+				[this](auto& mem, auto pageno) -> const riscv::Page&
+				{
+					if (auto* cow = this->cow_page_read(pageno))
+						return *cow;
+					return riscv::Memory<MARCH>::default_page_read(mem, pageno);
+				});
+		}
 		// Override the way we build new execute segments
 		// on this machine.
 		// If the segment is obviously outside of the image
@@ -132,6 +156,37 @@ void Script::machine_remote_setup()
 
 } // Script::machine_remote_setup()
 
+riscv::Page* Script::cow_page_fault(riscv::Memory<MARCH>& mem, gaddr_t pageno)
+{
+	// Copy-on-write: The page is copied from the snapshot on first write
+	if (this->m_cow_source != nullptr
+		&& pageno * riscv::Page::size() < m_cow_source->memory.memory_arena_size())
+	{
+		auto* pdata = (const riscv::PageData *)m_cow_source->memory.memory_arena_ptr();
+		auto& page = mem.allocate_page(pageno, riscv::PageData::UNINITIALIZED);
+		std::memcpy(page.data(), &pdata[pageno], riscv::Page::size());
+		return &page;
+	}
+	return nullptr;
+}
+
+const riscv::Page* Script::cow_page_read(gaddr_t pageno)
+{
+	// Copy-on-write: Reads are served directly from the snapshot until the
+	// page is written to, at which point the page is made writable (copied).
+	if (this->m_cow_source != nullptr
+		&& pageno * riscv::Page::size() < m_cow_source->memory.memory_arena_size())
+	{
+		auto* pdata = (riscv::PageData *)m_cow_source->memory.memory_arena_ptr();
+		riscv::PageAttributes attr;
+		attr.write		= false;
+		attr.is_cow		= true;
+		attr.non_owning = true;
+		return &machine().memory.allocate_page(pageno, attr, &pdata[pageno]);
+	}
+	return nullptr;
+}
+
 void Script::setup_remote_calls_to(Script& dest)
 {
 	// Allow calling another pre-determined machine
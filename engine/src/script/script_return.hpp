@@ -0,0 +1,98 @@
+#pragma once
+#include <cstring>
+#include <libriscv/machine.hpp>
+#include <type_traits>
+#include <utility>
+
+/// @brief Reads a value of type R returned by a guest function from the
+/// registers, following the RISC-V calling convention:
+/// - Integers, enums and structs up to 2 * XLEN bytes are packed into a0 and a1
+/// - float and double are returned in fa0
+/// - std::pair with a floating-point member returns each member in the next
+///   free integer or floating-point register, eg. a0 and fa0
+/// Structs with one or two floating-point members, such as a vec2, are also
+/// returned in fa0 and fa1, but that can not be detected. Return those as a
+/// std::pair, or specialize ScriptReturn for the struct.
+template <typename R, typename = void>
+struct ScriptReturn
+{
+	static_assert(std::is_trivially_copyable_v<R>, "Return values must be trivially copyable");
+	static_assert(!std::is_pointer_v<R>, "Guest pointers are not host pointers");
+
+	template <int W>
+	static R get(const riscv::Machine<W>& m)
+	{
+		static_assert(sizeof(R) <= 2 * W, "Return values must fit in two registers");
+		if constexpr ((std::is_integral_v<R> || std::is_enum_v<R>) && sizeof(R) <= W)
+		{
+			return static_cast<R>(m.cpu.reg(riscv::REG_ARG0));
+		}
+		else
+		{
+			const riscv::address_type<W> regs[2] {
+				m.cpu.reg(riscv::REG_ARG0), m.cpu.reg(riscv::REG_ARG1)};
+			R result;
+			std::memcpy(&result, regs, sizeof(R));
+			return result;
+		}
+	}
+};
+
+template <typename R>
+struct ScriptReturn<R, std::enable_if_t<std::is_floating_point_v<R>>>
+{
+	static_assert(sizeof(R) <= 8, "Only float and double are supported");
+
+	template <int W>
+	static R get(const riscv::Machine<W>& m)
+	{
+		return from_fpreg(m, riscv::REG_FA0);
+	}
+
+	template <int W>
+	static R from_fpreg(const riscv::Machine<W>& m, unsigned reg)
+	{
+		const auto& fpreg = m.cpu.registers().getfl(reg);
+		if constexpr (sizeof(R) == 4)
+			return fpreg.f32[0];
+		else
+			return fpreg.f64;
+	}
+};
+
+template <typename A, typename B>
+struct ScriptReturn<std::pair<A, B>>
+{
+	template <int W>
+	static std::pair<A, B> get(const riscv::Machine<W>& m)
+	{
+		if constexpr (!std::is_floating_point_v<A> && !std::is_floating_point_v<B>)
+		{
+			// Only integers: The same as any other struct
+			struct Packed { A first; B second; };
+			const auto packed = ScriptReturn<Packed>::get(m);
+			return {packed.first, packed.second};
+		}
+		else
+		{
+			// Each member goes into the first free register of its kind
+			return {member<A>(m, riscv::REG_ARG0, riscv::REG_FA0),
+				member<B>(m,
+					std::is_floating_point_v<A> ? riscv::REG_ARG0 : riscv::REG_ARG1,
+					std::is_floating_point_v<A> ? riscv::REG_FA1 : riscv::REG_FA0)};
+		}
+	}
+
+  private:
+	template <typename T, int W>
+	static T member(const riscv::Machine<W>& m, unsigned ireg, unsigned freg)
+	{
+		if constexpr (std::is_floating_point_v<T>)
+			return ScriptReturn<T>::from_fpreg(m, freg);
+		else
+		{
+			static_assert(sizeof(T) <= W, "Pair members must fit in a register");
+			return static_cast<T>(m.cpu.reg(ireg));
+		}
+	}
+};
@@ -0,0 +1,236 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include "script_function.hpp"
+
+/// @brief The string definition of a dynamic call, parsed at compile-time,
+/// eg. "int sys_timer_periodic (float, float, timer_callback, void*, size_t)".
+/// The definition is single-spaced and hashed the same way as the dynamic
+/// call table of the programs, and each type is sorted into the kind of
+/// register it is passed in. See: Script::bind()
+template <size_t N>
+struct DyncallSignature
+{
+	enum class Kind : uint8_t {
+		Void,
+		Integer,
+		Float,
+		Double,
+		/// @brief A zero-terminated const char*
+		String,
+		Pointer,
+		/// @brief Any other named type, such as a callback typedef
+		Opaque,
+	};
+	static constexpr size_t MAX_PARAMS = 16;
+
+	consteval DyncallSignature(const char (&str)[N])
+	{
+		// Single-spaced, just like the generated dynamic call table
+		bool space = false;
+		for (size_t i = 0; i + 1 < N; i++)
+		{
+			const char c = str[i];
+			if (c == ' ' || c == '\t' || c == '\n') {
+				space = (size > 0);
+				continue;
+			}
+			if (space)
+				def[size++] = ' ';
+			space = false;
+			def[size++] = c;
+		}
+		hash = ScriptFunction::hash_of(view());
+		valid = parse();
+	}
+
+	constexpr std::string_view view() const noexcept { return {def, size}; }
+
+	char def[N] {};
+	size_t size = 0;
+	uint32_t hash = 0;
+	bool valid = false;
+	Kind ret = Kind::Void;
+	Kind params[MAX_PARAMS] {};
+	size_t param_count = 0;
+
+  private:
+	static constexpr std::string_view trim(std::string_view s)
+	{
+		while (!s.empty() && s.front() == ' ') s.remove_prefix(1);
+		while (!s.empty() && s.back() == ' ') s.remove_suffix(1);
+		return s;
+	}
+
+	// Plain loops, as string_view::find is not usable on a template
+	// parameter object under construction with some compilers
+	static constexpr size_t find(std::string_view s, char c)
+	{
+		for (size_t i = 0; i < s.size(); i++)
+			if (s[i] == c) return i;
+		return std::string_view::npos;
+	}
+	static constexpr size_t rfind(std::string_view s, char c)
+	{
+		for (size_t i = s.size(); i > 0; i--)
+			if (s[i-1] == c) return i-1;
+		return std::string_view::npos;
+	}
+
+	static constexpr Kind classify(std::string_view type)
+	{
+		if (find(type, '*') != std::string_view::npos)
+		{
+			std::string_view t = type;
+			if (t.starts_with("const "))
+				t.remove_prefix(6);
+			// char * and char* are the same type
+			if (t.starts_with("char") && trim(t.substr(4)) == "*")
+				return Kind::String;
+			return Kind::Pointer;
+		}
+		if (type.starts_with("const "))
+			type.remove_prefix(6);
+		if (type == "void")
+			return Kind::Void;
+		if (type == "float")
+			return Kind::Float;
+		if (type == "double")
+			return Kind::Double;
+		constexpr std::string_view integers[] {
+			"bool", "char", "signed char", "unsigned char", "short", "unsigned short",
+			"int", "unsigned", "unsigned int", "long", "unsigned long",
+			"long long", "unsigned long long", "size_t", "ssize_t",
+			"intptr_t", "uintptr_t", "int8_t", "uint8_t", "int16_t", "uint16_t",
+			"int32_t", "uint32_t", "int64_t", "uint64_t",
+		};
+		for (const auto integer : integers)
+			if (type == integer)
+				return Kind::Integer;
+		return Kind::Opaque;
+	}
+
+	constexpr bool parse()
+	{
+		const auto sig = view();
+		const size_t open = find(sig, '(');
+		const size_t close = rfind(sig, ')');
+		if (open == std::string_view::npos || close == std::string_view::npos || close < open)
+			return false;
+		// The return type is everything before the function name
+		const auto head = trim(sig.substr(0, open));
+		const size_t name = rfind(head, ' ');
+		if (name == std::string_view::npos)
+			return false;
+		ret = classify(trim(head.substr(0, name)));
+
+		auto list = trim(sig.substr(open + 1, close - open - 1));
+		if (list.empty() || list == "void")
+			return true;
+		while (true)
+		{
+			const size_t comma = find(list, ',');
+			const auto param = trim(list.substr(0, comma));
+			if (param.empty() || param_count == MAX_PARAMS)
+				return false;
+			params[param_count] = classify(param);
+			if (params[param_count++] == Kind::Void)
+				return false;
+			if (comma == std::string_view::npos)
+				return true;
+			list = list.substr(comma + 1);
+		}
+	}
+};
+
+/// @brief The return and parameter types of a dynamic call handler,
+/// which is either a function pointer or a lambda
+template <typename F>
+struct DyncallFunctionTraits : DyncallFunctionTraits<decltype(&F::operator())> {};
+template <typename R, typename First, typename... Args>
+struct DyncallFunctionTraits<R(*)(First, Args...)> {
+	using ret = R;
+	using first = First;
+	using args = std::tuple<Args...>;
+};
+template <typename C, typename R, typename First, typename... Args>
+struct DyncallFunctionTraits<R(C::*)(First, Args...)>
+	: DyncallFunctionTraits<R(*)(First, Args...)> {};
+template <typename C, typename R, typename First, typename... Args>
+struct DyncallFunctionTraits<R(C::*)(First, Args...) const>
+	: DyncallFunctionTraits<R(*)(First, Args...)> {};
+
+/// @brief Checks handler types against the kinds of a DyncallSignature
+struct DyncallTypeCheck
+{
+	template <typename T> struct is_span : std::false_type {};
+	template <typename T, size_t E> struct is_span<std::span<T, E>> : std::true_type {};
+
+	template <typename Kind, typename T>
+	static constexpr bool matches(Kind kind)
+	{
+		using U = std::decay_t<T>;
+		constexpr bool integer = std::is_integral_v<U> || std::is_enum_v<U>;
+		switch (kind)
+		{
+		case Kind::Integer:
+			return integer;
+		case Kind::Float:
+			return std::is_same_v<U, float>;
+		case Kind::Double:
+			return std::is_same_v<U, double>;
+		case Kind::String:
+			return std::is_same_v<U, std::string> || integer;
+		case Kind::Pointer:
+		case Kind::Opaque:
+			return std::is_pointer_v<U> || integer;
+		default:
+			return false;
+		}
+	}
+
+	/// @brief A string_view or a span is passed as a pointer and a size
+	template <typename T>
+	static constexpr size_t registers()
+	{
+		using U = std::decay_t<T>;
+		return (std::is_same_v<U, std::string_view> || is_span<U>::value) ? 2 : 1;
+	}
+
+	template <auto Sig, typename... Args>
+	static constexpr bool parameters_match(std::tuple<Args...>*)
+	{
+		using Kind = typename decltype(Sig)::Kind;
+		size_t i = 0;
+		bool ok = true;
+		[[maybe_unused]] auto check = [&] <typename T> () {
+			if (registers<T>() == 2) {
+				ok = ok && i + 1 < Sig.param_count
+					&& (Sig.params[i] == Kind::String || Sig.params[i] == Kind::Pointer)
+					&& Sig.params[i + 1] == Kind::Integer;
+				i += 2;
+			} else {
+				ok = ok && i < Sig.param_count && matches<Kind, T>(Sig.params[i]);
+				i += 1;
+			}
+		};
+		(check.template operator()<Args>(), ...);
+		return ok && i == Sig.param_count;
+	}
+
+	template <auto Sig, typename R>
+	static constexpr bool return_matches()
+	{
+		using Kind = typename decltype(Sig)::Kind;
+		if constexpr (std::is_void_v<R>)
+			return Sig.ret == Kind::Void;
+		else if constexpr (std::is_arithmetic_v<R> || std::is_enum_v<R>)
+			return Sig.ret != Kind::Void && matches<Kind, R>(Sig.ret);
+		else
+			return false;
+	}
+};
@@ -0,0 +1,169 @@
+#include "script.hpp"
+
+#include <libriscv/native_heap.hpp>
+#include <libriscv/util/crc32.hpp>
+#include <stdexcept>
+using riscv::crc32;
+
+std::shared_ptr<const Script::Snapshot> Script::snapshot()
+{
+	if (this->m_call_depth != 0)
+		throw std::runtime_error(
+			this->name() + ": Unable to snapshot during a call");
+	// Remote calls install handlers that refer to another Script
+	if (this->m_remote_script != nullptr)
+		throw std::runtime_error(
+			this->name() + ": Unable to snapshot after remote calls are set up");
+
+	// The instance runs without an arena after a checkpoint
+	if (this->m_checkpoint != nullptr)
+		throw std::runtime_error(
+			this->name() + ": Unable to snapshot after a checkpoint");
+
+	this->warm();
+
+	auto snapshot = std::make_shared<Snapshot>();
+	snapshot->program		= this->m_program;
+	snapshot->filename		= this->m_filename;
+	snapshot->heap_area		= this->m_heap_area;
+	snapshot->dyncall_table = this->m_g_dyncall_table;
+	snapshot->dyncalls		= this->m_resolved_dyncalls;
+	snapshot->is_debug		= this->m_is_debug;
+	// Forks reference the pages of the snapshot machine, which means
+	// it can never run again. This instance continues on a fork.
+	snapshot->machine = std::move(this->m_machine);
+
+	this->m_snapshot = snapshot;
+	this->fork_from(*snapshot);
+	return snapshot;
+}
+
+Script::Script(
+	std::shared_ptr<const Snapshot> snapshot, const std::string& name,
+	void* userptr, CloneMode mode)
+  : m_program(snapshot->program), m_snapshot(snapshot),
+	m_userptr(userptr), m_name(name), m_filename(snapshot->filename),
+	m_hash(crc32(name.c_str(), name.size())), m_is_debug(snapshot->is_debug)
+{
+	if (mode == CloneMode::CopyOnWrite)
+		this->m_cow_source = snapshot->machine.get();
+	this->fork_from(*snapshot);
+}
+
+void Script::fork_from(const Snapshot& snapshot)
+{
+	// The fork shares all pages of the snapshot copy-on-write, and
+	// inherits registers, threads and the heap arena state. Copy-on-write
+	// clones have no memory arena, and instead share the snapshots arena
+	// pages through the page fault handlers. See: machine_remote_setup()
+	m_machine = std::make_unique<machine_t> (*snapshot.machine, machine_options());
+
+	this->m_heap_area		= snapshot.heap_area;
+	this->m_g_dyncall_table = snapshot.dyncall_table;
+	this->use_dynamic_calls(snapshot.dyncalls);
+
+	// Callbacks that refer to the owning Script must be installed again
+	this->machine_instance_setup();
+	this->machine_remote_setup();
+	this->add_shared_memory();
+}
+
+void Script::checkpoint()
+{
+	if (this->m_call_depth != 0 || this->m_async_call)
+		throw std::runtime_error(
+			this->name() + ": Unable to checkpoint during a call");
+	if (this->m_remote_script != nullptr)
+		throw std::runtime_error(
+			this->name() + ": Unable to checkpoint after remote calls are set up");
+
+	this->warm();
+
+	if (this->m_checkpoint != nullptr)
+	{
+		// The written pages become part of the checkpoint
+		this->restore_dirty_pages(true);
+		m_checkpoint->cpu.registers() = machine().cpu.registers();
+		m_checkpoint->memory.mmap_address() = machine().memory.mmap_address();
+		machine().arena().transfer(m_checkpoint->arena());
+		m_checkpoint_arguments = m_argument_arena;
+		return;
+	}
+	// Reads of arena pages would have to be forwarded twice
+	if (this->m_cow_source != nullptr)
+		throw std::runtime_error(
+			this->name() + ": Unable to checkpoint a copy-on-write clone");
+
+	// Just like a snapshot, the checkpoint machine never runs again.
+	// Pages owned by the fork are exactly the pages written since.
+	m_checkpoint = std::move(this->m_machine);
+	m_cow_source = m_checkpoint.get();
+	m_machine = std::make_unique<machine_t> (*m_checkpoint, machine_options());
+
+	this->machine_instance_setup();
+	this->machine_remote_setup();
+	this->add_shared_memory();
+	m_checkpoint_arguments = m_argument_arena;
+}
+
+size_t Script::rollback()
+{
+	if (this->m_checkpoint == nullptr)
+		throw std::runtime_error(
+			this->name() + ": No checkpoint to roll back to");
+	if (this->m_call_depth != 0)
+		throw std::runtime_error(
+			this->name() + ": Unable to roll back during a call");
+	// The task would continue on rolled back memory and registers
+	if (this->m_async_call)
+		throw std::runtime_error(
+			this->name() + ": Unable to roll back during an async call");
+
+	const size_t pages = this->restore_dirty_pages(false);
+	machine().cpu.registers() = m_checkpoint->cpu.registers();
+	// Mappings made since the checkpoint are gone with their pages
+	machine().memory.mmap_address() = m_checkpoint->memory.mmap_address();
+	m_checkpoint->arena().transfer(machine().arena());
+	this->m_arguments.clear();
+	// Arguments placed since the checkpoint are gone
+	m_argument_arena = m_checkpoint_arguments;
+	return pages;
+}
+
+size_t Script::restore_dirty_pages(bool commit)
+{
+	auto& mem = machine().memory;
+	const auto& source = m_checkpoint->memory;
+
+	// Shared pages are non-owning, including the shared memory area
+	std::vector<gaddr_t> dirty;
+	for (const auto& it : mem.pages())
+	{
+		if (!it.second.attr.non_owning)
+			dirty.push_back(it.first);
+	}
+
+	for (const gaddr_t pageno : dirty)
+	{
+		const gaddr_t addr = pageno * riscv::Page::size();
+		if (commit)
+			m_checkpoint->memory.memcpy(
+				addr, mem.get_pageno(pageno).data(), riscv::Page::size());
+		mem.free_pages(addr, riscv::Page::size());
+
+		// Arena pages are shared again through the page read handler, but
+		// pages outside of the arena must be shared with the fork directly.
+		auto it = source.pages().find(pageno);
+		if (addr >= source.memory_arena_size() && it != source.pages().end())
+		{
+			riscv::PageAttributes attr = it->second.attr;
+			attr.write		= false;
+			attr.is_cow		= true;
+			attr.non_owning = true;
+			mem.allocate_page(pageno, attr, const_cast<riscv::PageData*>(&it->second.page()));
+		}
+	}
+	// Cached pages may have been replaced
+	mem.invalidate_reset_cache();
+	return dirty.size();
+}
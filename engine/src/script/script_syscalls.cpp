@@ -54,7 +54,7 @@ APICALL(api_measure)
 		= machine.template sysargs<std::string, gaddr_t>();
 	auto& scr	 = script(machine);
 	auto time_ns = scr.vmbench(address);
-	strf::to(stdout)(
+	strf::to(Script::output())(
 		"[", scr.name(), "] Measurement \"", test, "\" median: ", time_ns,
 		"\n\n");
 	machine.set_result(time_ns);
@@ -73,11 +73,11 @@ APICALL(api_dyncall_args)
 	const auto [hash, g_name] = machine.sysargs<uint32_t, gaddr_t>();
 
 	auto& scr = script(machine);
+	// The arguments are cleared after the call, even if it throws
+	const ScriptArgs::CallScope scope(scr.dynargs());
 	// Perform a dynamic call, which takes no arguments
 	// Instead, the caller must check the dynargs() vector.
 	scr.dynamic_call_hash(hash, g_name);
-	// After the call we can clear dynargs.
-	scr.dynargs().clear();
 }
 
 APICALL(api_machine_hash)
@@ -96,14 +96,14 @@ APICALL(api_game_setting)
 
 	auto value = Script::get_global_setting(setting);
 	if (!value.has_value()) {
-		strf::to(stdout)("[", script(machine).name(), "] Warning: Could not find", setting, "\n");
+		strf::to(Script::output())("[", script(machine).name(), "] Warning: Could not find", setting, "\n");
 	}
 	machine.set_result(value.has_value(), value.value_or(0x0));
 }
 
 APICALL(api_game_exit)
 {
-	strf::to(stdout)("[", script(machine).name(), "] Exit called\n");
+	strf::to(Script::output())("[", script(machine).name(), "] Exit called\n");
 	script(machine).exit();
 }
 
@@ -209,28 +209,28 @@ void Script::setup_syscall_interface()
 			switch (instr.Utype.rd)
 			{
 			case 0x0: // 64-bit signed integer immediate
-				scr.dynargs().emplace_back((int64_t)instr.Itype.signed_imm());
+				scr.dynargs().push_back((int64_t)instr.Itype.signed_imm());
 				break;
 			case 0x1: // 64-bit signed integer
-				scr.dynargs().emplace_back((int64_t)cpu.reg(riscv::REG_ARG0));
+				scr.dynargs().push_back((int64_t)cpu.reg(riscv::REG_ARG0));
 				break;
 			case 0x3: // 32-bit floating point
-				scr.dynargs().emplace_back(
+				scr.dynargs().push_back(
 					cpu.registers().getfl(riscv::REG_FA0).f32[0]);
 				break;
-			case 0x7: // std::string
-				scr.dynargs().emplace_back(
-					cpu.machine().memory.memstring(cpu.reg(riscv::REG_ARG0)));
+			case 0x7: // zero-terminated string, viewed in guest memory
+				scr.dynargs().push_back(
+					cpu.machine().memory.memstring_view(cpu.reg(riscv::REG_ARG0)));
 				break;
 			case 0x1F: { // complete the dynamic argument call
 				const auto [hash, g_name] = cpu.machine().sysargs<uint32_t, gaddr_t>();
 
 				auto& scr = script(cpu.machine());
+				// The arguments are cleared after the call, even if it throws
+				const ScriptArgs::CallScope scope(scr.dynargs());
 				// Perform a dynamic call, which takes no arguments
 				// Instead, the caller must check the dynargs() vector.
 				scr.dynamic_call_hash(hash, g_name);
-				// After the call we can clear dynargs.
-				scr.dynargs().clear();
 				return;
 			}
 			default:
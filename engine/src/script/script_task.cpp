@@ -0,0 +1,62 @@
+#include "script_task.hpp"
+
+ScriptTask::ScriptTask(Script& script, Script::gaddr_t address)
+  : m_script(&script), m_address(address)
+{
+}
+
+ScriptTask::ScriptTask(ScriptTask&& other) noexcept
+  : m_script(other.m_script), m_address(other.m_address),
+	m_state(other.m_state), m_result(other.m_result),
+	m_ticks(other.m_ticks), m_instructions(other.m_instructions)
+{
+	other.m_script = nullptr;
+}
+
+ScriptTask::~ScriptTask()
+{
+	// Abandon the call, letting the next call into the script start over
+	if (m_script != nullptr && !done())
+		m_script->m_async_call = false;
+}
+
+bool ScriptTask::resume(uint64_t budget)
+{
+	if (done())
+		return true;
+	if (UNLIKELY(m_script == nullptr))
+		throw std::runtime_error("ScriptTask::resume(): Moved-from task");
+
+	auto& script = *m_script;
+	auto& m = script.machine();
+	// Calls made from the host while the task is running are nested calls
+	ScriptDepthMeter meter(script.m_call_depth);
+	try
+	{
+		// Each tick counts from zero, so that the counter is the delta
+		m.set_instruction_counter(0);
+		m.resume<false>(budget);
+		m_ticks++;
+		m_instructions += m.instruction_counter();
+		// Running out of instructions only means the task continues next tick
+		if (!m.stopped())
+			return false;
+
+		m_result = Script::sgaddr_t(m.cpu.reg(riscv::REG_ARG0));
+		this->finish(false);
+	}
+	catch (const std::exception& e)
+	{
+		script.handle_exception(m_address, e);
+		this->finish(true);
+	}
+	return true;
+}
+
+void ScriptTask::finish(bool failed)
+{
+	m_state = failed ? State::Failed : State::Done;
+	m_script->m_async_call = false;
+	if (!failed)
+		m_script->m_call_stats[m_address].instructions += m_instructions;
+}
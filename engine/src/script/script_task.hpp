@@ -0,0 +1,81 @@
+#pragma once
+#include "script.hpp"
+
+/// @brief A function call into a Script that is spread out over many
+/// engine ticks, eg. path-finding or procedural generation. Started with
+/// Script::async_call(), and driven by calling resume() every tick, with
+/// an instruction budget per tick, until done(). A tick that runs out of
+/// instructions is not an error, the call simply continues next tick.
+///
+/// Example:
+/// auto task = script.async_call("find_path"_fn, from, to);
+/// ...each tick:
+/// if (task.resume(50'000) && task.result())
+/// 	use_path(*task.result());
+///
+/// Destroying a task that is not done abandons the call.
+struct ScriptTask
+{
+	/// @brief Continue the call for up to budget instructions.
+	/// @param budget The max number of instructions to execute this tick.
+	/// @return True when the call has completed, or has failed.
+	bool resume(uint64_t budget);
+
+	bool done() const noexcept { return m_state != State::Running; }
+	bool failed() const noexcept { return m_state == State::Failed; }
+
+	/// @brief The integral return value of the function, once done.
+	/// Empty while in progress, and when the call failed.
+	std::optional<Script::sgaddr_t> result() const noexcept { return m_result; }
+
+	/// @brief The address of the function being called.
+	Script::gaddr_t address() const noexcept { return m_address; }
+	/// @brief The number of engine ticks the call has been resumed.
+	uint64_t ticks() const noexcept { return m_ticks; }
+	/// @brief The total number of instructions executed by the call.
+	uint64_t instructions() const noexcept { return m_instructions; }
+
+	ScriptTask(ScriptTask&&) noexcept;
+	ScriptTask& operator=(ScriptTask&&) = delete;
+	~ScriptTask();
+
+  private:
+	friend struct Script;
+	ScriptTask(Script&, Script::gaddr_t address);
+	void finish(bool failed);
+
+	enum class State : uint8_t { Running, Done, Failed };
+	Script* m_script;
+	Script::gaddr_t m_address;
+	State m_state = State::Running;
+	std::optional<Script::sgaddr_t> m_result = std::nullopt;
+	uint64_t m_ticks = 0;
+	uint64_t m_instructions = 0;
+};
+
+template <typename... Args>
+inline ScriptTask Script::async_call(gaddr_t address, Args&&... args)
+{
+	if (UNLIKELY(m_call_depth != 0 || m_async_call))
+		throw std::runtime_error(name() + ": Async calls cannot be nested, or overlap");
+
+	// Set up the call without executing anything, the same as vmcall()
+	auto& m = machine();
+	this->account_call(address);
+	m.cpu.reset_stack_pointer();
+	m.setup_call(guest_argument(std::forward<Args>(args))...);
+	m.cpu.jump(address);
+	m.set_instruction_counter(0);
+	m_async_call = true;
+	return ScriptTask(*this, address);
+}
+
+template <typename... Args>
+inline ScriptTask Script::async_call(const ScriptFunction& func, Args&&... args)
+{
+	const auto address = this->address_of(func);
+	if (UNLIKELY(address == 0x0))
+		throw std::runtime_error(name() + ": Could not find function '"
+			+ std::string(func.name()) + "'");
+	return this->async_call(address, std::forward<Args>(args)...);
+}
@@ -0,0 +1,96 @@
+#include <script/script.hpp>
+#include <algorithm>
+#include <strf/to_cfile.hpp>
+
+/**
+ * Boots each program N times, and reports the percentiles of each
+ * startup phase in nanoseconds, as one JSON object per program.
+ * The program cache is bypassed, so that every boot loads the file anew.
+ *
+ * ./startup_bench [rounds] [program.elf ...]
+**/
+static const std::vector<std::string> default_programs {
+	"scripts/gameplay.elf", "scripts/level1.elf", "scripts/level2.elf"
+};
+
+static int64_t percentile(std::vector<int64_t> samples, unsigned pct)
+{
+	std::sort(samples.begin(), samples.end());
+	return samples[std::min(samples.size() - 1, samples.size() * pct / 100)];
+}
+
+static void report(const std::string& phase, const std::vector<int64_t>& samples, bool last)
+{
+	strf::to(stdout)(
+		"    \"", phase, "\": {\"p50\": ", percentile(samples, 50),
+		", \"p90\": ", percentile(samples, 90),
+		", \"p99\": ", percentile(samples, 99), "}", last ? "\n" : ",\n");
+}
+
+int main(int argc, char** argv)
+{
+	const size_t rounds = (argc > 1) ? std::max(1, atoi(argv[1])) : 20;
+	std::vector<std::string> programs;
+	for (int i = 2; i < argc; i++)
+		programs.push_back(argv[i]);
+	if (programs.empty())
+		programs = default_programs;
+
+	// Programs may make dynamic calls during initialization
+	extern void setup_timer_system();
+	setup_timer_system();
+	extern void setup_debugging_system();
+	setup_debugging_system();
+	extern void setup_dynamic_calls();
+	setup_dynamic_calls();
+	Script::on_exit([] (auto& script) {
+		script.machine().stop();
+	});
+
+	// Every boot reports that it has been initialized
+	FILE* devnull = fopen("/dev/null", "w");
+
+	strf::to(stdout)("[\n");
+	for (size_t p = 0; p < programs.size(); p++)
+	{
+		const auto& filename = programs[p];
+		std::vector<int64_t> load_file, construct, machine_setup,
+			resolve_dynamic_calls, setup_linux, simulate, total;
+		bool binary_translated = false;
+
+		for (size_t i = 0; i < rounds; i++)
+		{
+			Script::set_output(devnull);
+			Script script {Program::open(filename), "bench", filename};
+			Script::set_output(nullptr);
+
+			const auto& t = script.startup_times();
+			load_file.push_back(t.load_file);
+			construct.push_back(t.construct);
+			machine_setup.push_back(t.machine_setup);
+			resolve_dynamic_calls.push_back(t.resolve_dynamic_calls);
+			setup_linux.push_back(t.setup_linux);
+			simulate.push_back(t.simulate);
+			total.push_back(t.load_file + t.construct + t.machine_setup
+				+ t.resolve_dynamic_calls + t.setup_linux + t.simulate);
+			binary_translated = t.binary_translated;
+		}
+
+		strf::to(stdout)(
+			"  {\"filename\": \"", filename, "\", \"rounds\": ", rounds,
+			", \"binary_translated\": ", binary_translated ? "true" : "false", ",\n");
+		report("load_file", load_file, false);
+		report("construct", construct, false);
+		report("machine_setup", machine_setup, false);
+		report("resolve_dynamic_calls", resolve_dynamic_calls, false);
+		report("setup_linux", setup_linux, false);
+		report("simulate", simulate, false);
+		report("total", total, true);
+		strf::to(stdout)("  }", (p + 1 < programs.size()) ? ",\n" : "\n");
+	}
+	strf::to(stdout)("]\n");
+
+	if (devnull != nullptr)
+		fclose(devnull);
+	return 0;
+}
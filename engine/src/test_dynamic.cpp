@@ -16,39 +16,26 @@ void setup_dynamic_calls()
 			auto& args = script.dynargs();
 			for (size_t i = 0; i < args.size(); i++)
 			{
-				if (args[i].type() == typeid(std::string))
+				switch (args[i].type)
 				{
+				case ArgType::STRING:
 					strf::to(stdout)(
 						"Argument ", i,
-						" is a string: ", std::any_cast<std::string>(args[i]),
+						" is a string: ", args.get<std::string_view>(i),
 						"\n");
-				}
-				else if (args[i].type() == typeid(int64_t))
-				{
+					break;
+				case ArgType::INT64:
 					strf::to(stdout)(
 						"Argument ", i,
-						" is a 64-bit int: ", std::any_cast<int64_t>(args[i]),
+						" is a 64-bit int: ", args.get<int64_t>(i),
 						"\n");
-				}
-				else if (args[i].type() == typeid(float))
-				{
+					break;
+				case ArgType::FLOAT32:
 					strf::to(stdout)(
 						"Argument ", i,
-						" is a 32-bit float: ", std::any_cast<float>(args[i]),
+						" is a 32-bit float: ", args.get<float>(i),
 						"\n");
-				}
-				else if (args[i].type() == typeid(double))
-				{
-					strf::to(stdout)(
-						"Argument ", i,
-						" is a 64-bit float: ", std::any_cast<double>(args[i]),
-						"\n");
-				}
-				else
-				{
-					strf::to(stdout)(
-						"Argument ", i,
-						" is of unknown type: ", args[i].type().name(), "\n");
+					break;
 				}
 			}
 		});
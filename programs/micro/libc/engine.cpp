@@ -23,6 +23,23 @@ extern "C" void __attribute__((naked, used, retain)) fast_exit()
 	asm (".insn i SYSTEM, 0, x0, x0, 0x7ff");
 }
 
+/* Makes many calls with a single VM entry, see: Script::batch_call().
+   Each record is a function followed by up to 7 integral arguments. */
+extern "C" void __attribute__((used, retain))
+event_batch_trampoline(const uintptr_t* records, size_t count, size_t stride)
+{
+	using batch_func_t = void(*)(uintptr_t, uintptr_t, uintptr_t, uintptr_t,
+		uintptr_t, uintptr_t, uintptr_t);
+	for (size_t i = 0; i < count; i++, records += stride)
+	{
+		uintptr_t args[7] = {};
+		for (size_t j = 1; j < stride && j <= 7; j++)
+			args[j-1] = records[j];
+		((batch_func_t)records[0])(args[0], args[1], args[2], args[3],
+			args[4], args[5], args[6]);
+	}
+}
+
 asm(".global sys_write\n"
 "sys_write:\n"
 "	li a7, " STRINGIFY(ECALL_WRITE) "\n"
@@ -1,4 +1,9 @@
 #include "codebuilder.hpp"
+#include <script/script_loader.hpp>
+#include <script/script_pool.hpp>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <thread>
 
 TEST_CASE("Instantiate machine", "[Basic]")
 {
@@ -102,6 +107,164 @@ TEST_CASE("Verify late dynamic calls work", "[Basic]")
 	REQUIRE(count == 2);
 }
 
+TEST_CASE("Plain function dynamic call handlers", "[Basic]")
+{
+	const auto program = build_and_load(R"M(
+	#include <api.h>
+
+	extern "C" int my_func() {
+		sys_empty(); /* Opaque dynamic call */
+
+		isys_empty(); /* Inlined dynamic call */
+
+		return 666;
+	}
+
+	int main() {
+	})M");
+
+	// A function pointer and its userdata, without a std::function
+	int count = 0;
+	Script::set_dynamic_call("void sys_empty ()", "void sys_empty ()",
+		[] (Script&, void* userdata) {
+			*static_cast<int*>(userdata) += 1;
+		}, &count);
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	REQUIRE(script.call("my_func") == 666);
+	REQUIRE(count == 2);
+
+	// Lambdas without captures are called directly as well
+	static int static_count = 0;
+	Script::set_dynamic_call("void sys_empty ()", [] (Script&) {
+		static_count += 1;
+	});
+	Script other {program, "MyOtherScript", "/tmp/myscript"};
+	REQUIRE(other.call("my_func") == 666);
+	REQUIRE(static_count == 2);
+	REQUIRE(count == 2);
+}
+
+TEST_CASE("Late registration of dynamic calls", "[Basic]")
+{
+	const auto program = build_and_load(R"M(
+	#include <api.h>
+
+	extern "C" int my_func() {
+		sys_empty();
+		isys_empty();
+		return 666;
+	}
+
+	int main() {
+	})M");
+
+	// Both instances share the table resolved for the program
+	Script::set_dynamic_call("void sys_empty ()", nullptr);
+	Script script {program, "MyScript", "/tmp/myscript"};
+	Script other {program, "MyOtherScript", "/tmp/myscript"};
+	REQUIRE(!script.call("my_func"));
+
+	// Registering bumps the epoch, and the table is resolved again
+	static int count = 0;
+	Script::set_dynamic_call("void sys_empty ()", [] (Script&) {
+		count += 1;
+	});
+	REQUIRE(script.call("my_func") == 666);
+	REQUIRE(count == 2);
+	REQUIRE(other.call("my_func") == 666);
+	REQUIRE(count == 4);
+}
+
+TEST_CASE("Replaced dynamic calls", "[Basic]")
+{
+	const auto program = build_and_load(R"M(
+	#include <api.h>
+
+	extern "C" int my_func() {
+		sys_empty();
+		return 666;
+	}
+	extern "C" int late_func() {
+		sys_test_strings("1234", "45678", 5);
+		sys_empty();
+		return 666;
+	}
+
+	int main() {
+	})M");
+
+	static int first = 0, second = 0, late = 0;
+	first = second = late = 0;
+	Script::set_dynamic_call("void sys_test_strings (const char*, const char*, size_t)", nullptr);
+	Script::set_dynamic_call("void sys_empty ()", [] (Script&) {
+		first += 1;
+	});
+	Script script {program, "MyScript", "/tmp/myscript"};
+	REQUIRE(script.call("my_func") == 666);
+	REQUIRE(first == 1);
+
+	// The instance keeps the handler it resolved
+	Script::set_dynamic_call("void sys_empty ()", [] (Script&) {
+		second += 1;
+	});
+	REQUIRE(script.call("my_func") == 666);
+	REQUIRE(first == 2);
+	// While new instances resolve the new one
+	Script other {program, "MyOtherScript", "/tmp/myscript"};
+	REQUIRE(other.call("my_func") == 666);
+	REQUIRE(second == 1);
+	REQUIRE(first == 2);
+
+	// Resolving a late registration keeps the replaced handler too
+	Script::set_dynamic_call("void sys_test_strings (const char*, const char*, size_t)",
+	[] (Script&) {
+		late += 1;
+	});
+	REQUIRE(script.call("late_func") == 666);
+	REQUIRE(late == 1);
+	REQUIRE(first == 3);
+	REQUIRE(second == 1);
+	REQUIRE(other.call("late_func") == 666);
+	REQUIRE(late == 2);
+	REQUIRE(second == 2);
+}
+
+TEST_CASE("Unset dynamic calls are resolved on first use", "[Basic]")
+{
+	const auto program = build_and_load(R"M(
+	#include <api.h>
+
+	extern "C" int my_func() {
+		sys_empty();
+		return 666;
+	}
+
+	int main() {
+	})M");
+
+	Script::set_dynamic_call("void sys_empty ()", [] (Script&) {});
+	Script script {program, "MyScript", "/tmp/myscript"};
+	REQUIRE(script.call("my_func") == 666);
+
+	// Unsetting leaves the call unresolved for new instances
+	Script::set_dynamic_call("void sys_empty ()", nullptr);
+	Script other {program, "MyOtherScript", "/tmp/myscript"};
+	REQUIRE(!other.call("my_func"));
+	REQUIRE(!other.call("my_func"));
+	// Instances keep the handlers they were resolved with
+	REQUIRE(script.call("my_func") == 666);
+
+	// The unresolved entry resolves itself on the next call
+	static int count = 0;
+	Script::set_dynamic_call("void sys_empty ()", [] (Script&) {
+		count += 1;
+	});
+	REQUIRE(other.call("my_func") == 666);
+	REQUIRE(other.call("my_func") == 666);
+	REQUIRE(count == 2);
+}
+
 TEST_CASE("Verify dynamic calls with arguments", "[Basic]")
 {
 	const auto program = build_and_load(R"M(
@@ -222,3 +385,523 @@ TEST_CASE("Verify dynamic calls with arguments", "[Basic]")
 
 	REQUIRE(data_called == 1);
 }
+
+TEST_CASE("Dynamic argument calls", "[Basic]")
+{
+	const auto program = build_and_load(R"M(
+	#include <api.h>
+
+	extern "C" void test_dynargs() {
+		DynamicCall("Test::dynargs")(1234, 0.5f, "Hello World!");
+	}
+
+	int main() {
+	})M");
+
+	static int called = 0;
+	Script::set_dynamic_call("Test::dynargs", [] (Script& script) {
+		auto& args = script.dynargs();
+		REQUIRE(args.size() == 3);
+		REQUIRE(args[0].is_int64());
+		REQUIRE(args.get<int64_t>(0) == 1234);
+		REQUIRE(args.get<float>(1) == 0.5f);
+		// Strings are viewed in guest memory, without copying
+		REQUIRE(args.get<std::string_view>(2) == "Hello World!");
+		REQUIRE_THROWS(args.get<float>(2));
+		called += 1;
+	});
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	REQUIRE(script.call("test_dynargs"));
+	REQUIRE(script.call("test_dynargs"));
+	REQUIRE(called == 2);
+	// The arguments are cleared after each call
+	REQUIRE(script.dynargs().empty());
+
+	// Also when the handler throws
+	static bool fail = true;
+	Script::set_dynamic_call("Test::dynargs", [] (Script& script) {
+		REQUIRE(script.dynargs().size() == 3);
+		if (fail) throw std::runtime_error("Failed");
+		called += 1;
+	});
+	REQUIRE(!script.call("test_dynargs"));
+	REQUIRE(script.dynargs().empty());
+	fail = false;
+	REQUIRE(script.call("test_dynargs"));
+	REQUIRE(called == 3);
+}
+
+TEST_CASE("Dynamic calls by hash", "[Basic]")
+{
+	const auto program = build_and_load(R"M(
+	#include <api.h>
+
+	extern "C" void test_hashed() {
+		DynamicCall("Test::hashed")();
+	}
+
+	int main() {
+	})M");
+
+	static int called = 0;
+	Script::set_dynamic_call("Test::hashed", [] (Script&) {
+		called += 1;
+	});
+	Script script {program, "MyScript", "/tmp/myscript"};
+	REQUIRE(script.call("test_hashed"));
+	REQUIRE(called == 1);
+
+	// Registering from another thread while the instance keeps calling
+	std::thread registrar([] {
+		for (int i = 0; i < 2000; i++)
+			Script::set_dynamic_call("Test::filler" + std::to_string(i), nullptr);
+	});
+	for (int i = 0; i < 100; i++)
+		REQUIRE(script.call("test_hashed"));
+	registrar.join();
+	REQUIRE(called == 101);
+
+	// Replacing the handler is seen by the next lookup
+	Script::set_dynamic_call("Test::hashed", [] (Script&) {
+		called += 1000;
+	});
+	REQUIRE(script.call("test_hashed"));
+	REQUIRE(called == 1101);
+}
+
+TEST_CASE("Typed dynamic call handlers", "[Basic]")
+{
+	const auto program = build_and_load(R"M(
+	#include <api.h>
+
+	extern "C" void test_strings() {
+		sys_test_strings("1234", "45678", 5);
+	}
+	extern "C" void test_args() {
+		sys_test_3i3f(123, 456, 789, 10.0f, 100.0f, 1000.0f);
+	}
+
+	int main() {
+	})M");
+
+	// The definition is single-spaced and hashed at compile-time
+	static constexpr DyncallSignature def {"void  sys_test_3i3f (int, int, int,\tfloat, float, float)"};
+	static_assert(def.view() == "void sys_test_3i3f (int, int, int, float, float, float)");
+	static_assert(def.hash == ScriptFunction::hash_of(def.view()));
+	static_assert(def.param_count == 6);
+
+	// The handlers outlive the test, and must not refer to its stack
+	static int strings_called = 0;
+	static int args_called = 0;
+	strings_called = args_called = 0;
+	// A std::string_view consumes both the const char* and the size_t
+	Script::bind<"void sys_test_strings (const char*, const char*, size_t)">(
+	[] (Script&, std::string str, std::string_view view) {
+		REQUIRE(str == "1234");
+		REQUIRE(view == "45678");
+		strings_called += 1;
+	});
+	Script::bind<def>(
+	[] (Script&, int i1, int i2, int i3, float f1, float f2, float f3) {
+		REQUIRE(i1 + i2 + i3 == 123 + 456 + 789);
+		REQUIRE(f1 + f2 + f3 == 1110.0f);
+		args_called += 1;
+	});
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	REQUIRE(script.call("test_strings"));
+	REQUIRE(script.call("test_args"));
+	REQUIRE(strings_called == 1);
+	REQUIRE(args_called == 1);
+}
+
+TEST_CASE("Clone from snapshot", "[Basic]")
+{
+	const auto program = build_and_load(R"M(
+	static int value = 0;
+
+	extern "C" int bump() {
+		return ++value;
+	}
+
+	int main() {
+		return 666;
+	})M");
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	REQUIRE(script.call("bump") == 1);
+	REQUIRE(script.call("bump") == 2);
+
+	auto snapshot = script.snapshot();
+	REQUIRE(snapshot != nullptr);
+	// The original instance continues where it left off
+	REQUIRE(script.call("bump") == 3);
+
+	// Clones start from the snapshot, without running main() again
+	auto clone = script.clone("MyClone");
+	REQUIRE(clone.name() == "MyClone");
+	REQUIRE(clone.call("bump") == 3);
+	REQUIRE(clone.call("bump") == 4);
+
+	// Instances created from the snapshot are independent
+	Script other {snapshot, "MyOther"};
+	REQUIRE(other.call("bump") == 3);
+	REQUIRE(script.call("bump") == 4);
+}
+
+TEST_CASE("Copy-on-write clones", "[Basic]")
+{
+	const auto program = build_and_load(R"M(
+	static int value = 0;
+	static char buffer[65536];
+
+	extern "C" int bump() {
+		buffer[value * 4096] = value;
+		return ++value;
+	}
+
+	int main() {
+		return 666;
+	})M");
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	REQUIRE(script.call("bump") == 1);
+
+	// Copy-on-write clones are only possible from a snapshot
+	REQUIRE_THROWS(
+		[&] {
+			auto clone = script.clone("MyClone", nullptr, Script::CloneMode::CopyOnWrite);
+		}());
+
+	script.snapshot();
+	auto clone1 = script.clone("MyClone1", nullptr, Script::CloneMode::CopyOnWrite);
+	auto clone2 = script.clone("MyClone2", nullptr, Script::CloneMode::CopyOnWrite);
+
+	// Writes are private to each clone
+	REQUIRE(clone1.call("bump") == 2);
+	REQUIRE(clone1.call("bump") == 3);
+	REQUIRE(clone2.call("bump") == 2);
+	REQUIRE(script.call("bump") == 2);
+}
+
+TEST_CASE("Instances share cached programs", "[Basic]")
+{
+	const auto binary = build_and_load(R"M(
+	extern "C" int get_value() {
+		return 42;
+	}
+
+	int main() {
+		return 666;
+	})M");
+
+	Script script1 {binary, "MyScript1", "/tmp/myscript"};
+	// A copy of the same binary is found by its contents
+	auto copy = std::make_shared<std::vector<uint8_t>> (*binary);
+	Script script2 {copy, "MyScript2", "/tmp/myscript_copy"};
+	REQUIRE(&script1.program() == &script2.program());
+
+	// Symbol lookups are shared between instances
+	const auto addr = script1.address_of("get_value");
+	REQUIRE(addr != 0x0);
+	REQUIRE(script2.address_of("get_value") == addr);
+	REQUIRE(script2.call(addr) == 42);
+	// The decoded execute segment is shared by libriscv
+	if (getenv("REMOTE") == nullptr)
+		REQUIRE(&script1.machine().cpu.current_execute_segment()
+			== &script2.machine().cpu.current_execute_segment());
+}
+
+TEST_CASE("Memory-mapped programs", "[Basic]")
+{
+	const auto binary = build_and_load(R"M(
+	extern "C" int get_value() {
+		return 42;
+	}
+
+	int main() {
+		return 666;
+	})M");
+
+	const std::string filename = "/tmp/rvscript_mapped.elf";
+	FILE* f = fopen(filename.c_str(), "wb");
+	REQUIRE(f != nullptr);
+	REQUIRE(fwrite(binary->data(), 1, binary->size(), f) == binary->size());
+	fclose(f);
+
+	auto mapped = Program::open(filename, Program::Storage::Mapped);
+	auto heap = Program::open(filename, Program::Storage::Heap);
+	REQUIRE(mapped->storage() == Program::Storage::Mapped);
+	REQUIRE(mapped->hash() == heap->hash());
+	REQUIRE(mapped->binary() == heap->binary());
+
+	Script script {ProgramCache::insert(mapped), "MyScript", filename};
+	REQUIRE(script.call("get_value") == 42);
+	// Loading the file again finds the same program
+	REQUIRE(&script.program() == ProgramCache::load(filename).get());
+}
+
+TEST_CASE("Replaced program files", "[Basic]")
+{
+	const auto binary1 = build_and_load(R"M(
+	extern "C" int get_value() {
+		return 1;
+	}
+	int main() {})M");
+	const auto binary2 = build_and_load(R"M(
+	extern "C" int get_value() {
+		return 2;
+	}
+	int main() {})M");
+
+	const std::string filename = "/tmp/rvscript_replaced.elf";
+	auto write_file = [&] (const std::vector<uint8_t>& binary, time_t mtime) {
+		FILE* f = fopen(filename.c_str(), "wb");
+		REQUIRE(f != nullptr);
+		REQUIRE(fwrite(binary.data(), 1, binary.size(), f) == binary.size());
+		fclose(f);
+		const struct timespec times[2] {{mtime, 0}, {mtime, 0}};
+		REQUIRE(utimensat(AT_FDCWD, filename.c_str(), times, 0) == 0);
+	};
+
+	write_file(*binary1, 1000);
+	auto program1 = ProgramCache::load(filename);
+	REQUIRE(ProgramCache::load(filename) == program1);
+
+	write_file(*binary2, 2000);
+	auto program2 = ProgramCache::load(filename);
+	REQUIRE(program2 != program1);
+	Script script {program2, "MyScript", filename};
+	REQUIRE(script.call("get_value") == 2);
+
+	// The replaced contents are no longer cached, and are indexed again
+	REQUIRE(ProgramCache::insert(binary1, filename) != program1);
+}
+
+TEST_CASE("Boot scripts in parallel", "[Basic]")
+{
+	const auto binary1 = build_and_load(R"M(
+	extern "C" int get_value() {
+		return 1;
+	}
+	int main() {
+		return 666;
+	})M");
+	const auto binary2 = build_and_load(R"M(
+	extern "C" int get_value() {
+		return 2;
+	}
+	int main() {
+		return 666;
+	})M");
+
+	ScriptLoader loader;
+	for (int i = 0; i < 8; i++)
+	{
+		const auto& binary = (i % 2 == 0) ? binary1 : binary2;
+		loader.add(Program::from_binary(binary, "/tmp/myscript"),
+			"MyScript" + std::to_string(i), "/tmp/myscript");
+	}
+	auto scripts = loader.load(4);
+
+	// The scripts are returned in the order they were added
+	REQUIRE(scripts.size() == 8);
+	for (int i = 0; i < 8; i++)
+	{
+		REQUIRE(scripts[i]->name() == "MyScript" + std::to_string(i));
+		REQUIRE(scripts[i]->call("get_value") == 1 + (i % 2));
+	}
+}
+
+TEST_CASE("Deferred boot", "[Basic]")
+{
+	const auto binary = build_and_load(R"M(
+	static int value = 0;
+	extern "C" int get_value() {
+		return value;
+	}
+	int main() {
+		value = 42;
+		return 666;
+	})M");
+
+	Script script {binary, "MyScript", "/tmp/myscript", false, nullptr,
+		Script::BootMode::Deferred};
+	REQUIRE(!script.is_booted());
+
+	// The first call boots the program, running main()
+	REQUIRE(script.call("get_value") == 42);
+	REQUIRE(script.is_booted());
+
+	Script warmed {binary, "MyScript2", "/tmp/myscript", false, nullptr,
+		Script::BootMode::Deferred};
+	warmed.warm();
+	REQUIRE(warmed.is_booted());
+	REQUIRE(warmed.machine().return_value() == 666);
+
+	// Construction still rejects programs that are not RISC-V ELFs
+	auto bogus = std::make_shared<std::vector<uint8_t>> (128, 0);
+	REQUIRE_THROWS(
+		Script(bogus, "MyScript3", "/tmp/bogus", false, nullptr,
+			Script::BootMode::Deferred));
+}
+
+TEST_CASE("Checkpoint and rollback", "[Basic]")
+{
+	const auto binary = build_and_load(R"M(
+	static int value = 0;
+	static char buffer[65536];
+
+	extern "C" int bump() {
+		buffer[value * 4096] = value;
+		return ++value;
+	}
+	int main() {
+		return 666;
+	})M");
+
+	Script script {binary, "MyScript", "/tmp/myscript"};
+	REQUIRE(!script.has_checkpoint());
+	REQUIRE(script.call("bump") == 1);
+
+	script.checkpoint();
+	REQUIRE(script.has_checkpoint());
+	REQUIRE(script.call("bump") == 2);
+	REQUIRE(script.call("bump") == 3);
+	const auto addr = script.guest_alloc(64);
+	REQUIRE(addr != 0x0);
+	const auto mapping = script.machine().memory.mmap_allocate(4096);
+
+	// Only the pages written since the checkpoint are restored
+	REQUIRE(script.rollback() > 0);
+	REQUIRE(script.call("bump") == 2);
+	script.rollback();
+	REQUIRE(script.call("bump") == 2);
+	// The heap arena and the mmap area are restored too
+	REQUIRE(script.guest_alloc(64) == addr);
+	REQUIRE(script.machine().memory.mmap_allocate(4096) == mapping);
+
+	// A new checkpoint includes everything written so far
+	script.checkpoint();
+	REQUIRE(script.call("bump") == 3);
+	script.rollback();
+	REQUIRE(script.call("bump") == 3);
+}
+
+TEST_CASE("Recycle pooled instances", "[Basic]")
+{
+	const auto binary = build_and_load(R"M(
+	static int value = 0;
+
+	extern "C" int bump() {
+		return ++value;
+	}
+	int main() {
+		return 666;
+	})M");
+
+	ScriptPool pool(Program::from_binary(binary, "/tmp/myscript"),
+		"MyScript", "/tmp/myscript", 2);
+	REQUIRE(pool.stats().instances == 2);
+
+	{
+		auto lease1 = pool.acquire();
+		auto lease2 = pool.acquire();
+		REQUIRE(lease1->call("bump") == 1);
+		REQUIRE(lease1->call("bump") == 2);
+		REQUIRE(lease2->call("bump") == 1);
+		// The pool grows when all instances are in use
+		auto lease3 = pool.acquire();
+		REQUIRE(lease3->call("bump") == 1);
+	}
+	auto stats = pool.stats();
+	REQUIRE(stats.instances == 3);
+	REQUIRE(stats.in_use == 0);
+	REQUIRE(stats.high_water == 3);
+	REQUIRE(stats.grown == 1);
+
+	// Returned instances are rolled back to their booted state
+	auto lease = pool.acquire();
+	REQUIRE(lease->call("bump") == 1);
+	REQUIRE(pool.stats().acquires == 4);
+}
+
+TEST_CASE("Discard pooled instances released during a call", "[Basic]")
+{
+	const auto binary = build_and_load(R"M(
+	#include <api.h>
+
+	extern "C" int release_self() {
+		sys_empty();
+		return 666;
+	}
+	int main() {
+		return 666;
+	})M");
+
+	ScriptPool pool(Program::from_binary(binary, "/tmp/myscript"),
+		"MyScript", "/tmp/myscript", 1);
+	static std::optional<ScriptPool::Lease> lease;
+	lease.emplace(pool.acquire());
+	Script& script = **lease;
+
+	// The lease ends while the instance is still in a call
+	Script::set_dynamic_call("void sys_empty ()", [] (Script&) {
+		lease.reset();
+	});
+	REQUIRE(script.call("release_self") == 666);
+	Script::set_dynamic_call("void sys_empty ()", [] (Script&) {});
+
+	const auto stats = pool.stats();
+	REQUIRE(stats.discarded == 1);
+	REQUIRE(stats.in_use == 0);
+	// A new instance is created instead of reusing the discarded one
+	auto next = pool.acquire();
+	REQUIRE(&*next != &script);
+	REQUIRE(pool.stats().grown == 1);
+}
+
+TEST_CASE("Startup phases are timed", "[Basic]")
+{
+	const auto binary = build_and_load(R"M(
+	int main() {
+		return 666;
+	})M");
+
+	Script script {binary, "MyScript", "/tmp/myscript"};
+	const auto& times = script.startup_times();
+	REQUIRE(times.construct > 0);
+	REQUIRE(times.simulate > 0);
+
+	const auto report = script.startup_report();
+	REQUIRE_THAT(report, Catch::Matchers::StartsWith("{\"name\": \"MyScript\""));
+	REQUIRE_THAT(report, Catch::Matchers::ContainsSubstring("\"resolve_dynamic_calls\": "));
+}
+
+TEST_CASE("Shared symbol index", "[Basic]")
+{
+	const auto binary = build_and_load(R"M(
+	extern "C" int get_value() {
+		return 42;
+	}
+	int main() {
+		return 666;
+	})M");
+
+	auto program = Program::from_binary(binary, "/tmp/myscript");
+	// The index is built from the binary, without a machine
+	const std::string_view name = "get_value";
+	const auto addr = program->address_of(name);
+	REQUIRE(addr != 0x0);
+	REQUIRE(program->address_of("does_not_exist") == 0x0);
+
+	// Reverse lookups find the closest symbol
+	REQUIRE(program->lookup(addr).name == "get_value");
+	REQUIRE(program->lookup(addr + 4).offset == 4);
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	REQUIRE(script.address_of(name) == addr);
+	REQUIRE(script.symbol_name(addr) == "get_value");
+	REQUIRE(script.call(name) == 42);
+}
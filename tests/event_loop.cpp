@@ -1,4 +1,5 @@
 #include "codebuilder.hpp"
+#include <script/script_task.hpp>
 
 #include "../ext/libriscv/binaries/barebones/libc/include/event_loop.hpp"
 
@@ -226,3 +227,65 @@ TEST_CASE("Advanced event loop", "[EventLoop]")
 	REQUIRE(!shared_evs.at(1).has_work());
 	REQUIRE(expected_work == shared_objs.at(0).work_done);
 }
+
+TEST_CASE("Async calls over many ticks", "[EventLoop]")
+{
+	const auto program = build_and_load(R"M(
+	extern "C" long slow_sum(long n) {
+		long sum = 0;
+		for (volatile long i = 0; i < n; i++)
+			sum += i;
+		return sum;
+	}
+	extern "C" long quick(long n) {
+		return n * 2;
+	}
+
+	int main() {
+	})M");
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	const auto slow_sum = script.address_of("slow_sum");
+	REQUIRE(slow_sum != 0x0);
+
+	auto task = script.async_call(slow_sum, 10'000);
+	REQUIRE(script.has_async_call());
+	REQUIRE(!task.done());
+	// Only one async call at a time
+	REQUIRE_THROWS(script.async_call(slow_sum, 1));
+
+	// Each tick only gets a small budget
+	size_t ticks = 0;
+	while (!task.resume(5'000))
+	{
+		ticks++;
+		REQUIRE(!task.result());
+		// Other calls between ticks leave the task alone
+		REQUIRE(script.call("quick", 21) == 42);
+	}
+	REQUIRE(ticks > 1);
+	REQUIRE(task.done());
+	REQUIRE(!task.failed());
+	REQUIRE(task.ticks() == ticks + 1);
+	// Only the instructions of each tick are counted
+	REQUIRE(task.instructions() > 0);
+	REQUIRE(task.instructions() < task.ticks() * 6'000);
+	REQUIRE(task.result() == 10'000L * 9'999L / 2);
+	REQUIRE(!script.has_async_call());
+
+	// Regular calls work like before, and a new async call can start
+	REQUIRE(script.call("quick", 1) == 2);
+	auto second = script.async_call(slow_sum, 10);
+	REQUIRE(second.resume(Script::MAX_CALL_INSTR));
+	REQUIRE(second.result() == 45);
+
+	// Pending tasks cannot be rolled back underneath
+	script.checkpoint();
+	auto third = script.async_call(slow_sum, 10'000);
+	REQUIRE(!third.resume(5'000));
+	REQUIRE_THROWS(script.rollback());
+	REQUIRE_THROWS(script.checkpoint());
+	while (!third.resume(5'000));
+	REQUIRE(third.result() == 10'000L * 9'999L / 2);
+	REQUIRE(script.rollback() > 0);
+}
@@ -102,3 +102,228 @@ TEST_CASE("Simple events", "[Events]")
 	Event<void()> ev8(script, "FailingFunc");
 	REQUIRE(!ev8.call());
 }
+
+TEST_CASE("Function handles", "[Events]")
+{
+	const auto program = build_and_load(R"M(
+	#include <api.h>
+
+	int main() {}
+
+	extern "C" int IntFunc(int arg) {
+		return arg * 2;
+	}
+	)M");
+
+	static constexpr auto int_func = "IntFunc"_fn;
+	static_assert(int_func.hash() == ScriptFunction::hash_of("IntFunc"));
+	REQUIRE(int_func.name() == "IntFunc");
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	REQUIRE(script.address_of(int_func) == script.address_of("IntFunc"));
+	REQUIRE(script.call(int_func, 21) == 42);
+	REQUIRE(script.preempt(int_func, 21) == 42);
+	REQUIRE(!script.call("NoSuchFunc"_fn));
+
+	/* Handles are valid for every instance of the program */
+	script.snapshot();
+	auto clone = script.clone("MyClone");
+	REQUIRE(clone.call(int_func, 50) == 100);
+
+	Event<int(int)> ev(clone, int_func);
+	REQUIRE(*ev.call(123) == 246);
+
+	/* Each program remembers the handle on its own */
+	const auto other = build_and_load(R"M(
+	int main() {}
+	extern "C" int Padding(int arg) { return arg; }
+	extern "C" int IntFunc(int arg) { return arg * 3; }
+	)M");
+	Script other_script {other, "MyOtherScript", "/tmp/myscript"};
+	for (int i = 0; i < 3; i++) {
+		REQUIRE(other_script.call(int_func, 21) == 63);
+		REQUIRE(script.call(int_func, 21) == 42);
+	}
+	REQUIRE(other_script.address_of(int_func) == other_script.address_of("IntFunc"));
+	REQUIRE(script.address_of(int_func) == script.address_of("IntFunc"));
+}
+
+TEST_CASE("Batched events", "[Events]")
+{
+	const auto program = build_and_load(R"M(
+	#include <api.h>
+
+	int main() {}
+
+	static long total = 0;
+	extern "C" void Accumulate(int value, int factor) {
+		total += value * factor;
+	}
+	extern "C" long GetTotal() {
+		return total;
+	}
+	struct Object {
+		uintptr_t onEvent;
+		int value;
+	};
+	extern "C" void DoubleValue(Object& object) {
+		object.value *= 2;
+	}
+	)M");
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+
+	/* One VM entry for the whole batch */
+	Event<void(int, int), SharedScript> ev(script, "Accumulate");
+	std::vector<std::tuple<int, int>> batch;
+	for (int i = 1; i <= 100; i++)
+		batch.emplace_back(i, 2);
+	REQUIRE(ev.call_batch(std::span(batch)));
+	REQUIRE(script.call("GetTotal") == 5050 * 2);
+	/* Smaller and larger batches reuse the records */
+	REQUIRE(ev.call_batch(std::span(batch).first(10)));
+	REQUIRE(script.call("GetTotal") == (5050 + 55) * 2);
+	for (int i = 101; i <= 200; i++)
+		batch.emplace_back(i, 1);
+	REQUIRE(ev.call_batch(std::span(batch)));
+	REQUIRE(script.call("GetTotal") == (5050 + 55 + 5050) * 2 + 15050);
+
+	/* Call a member function address of each guest object */
+	struct Object {
+		Script::gaddr_t onEvent = 0x0;
+		int value = 0;
+	};
+	auto objs = script.guest_alloc<Object>(16);
+	for (size_t i = 0; i < 16; i++) {
+		objs.at(i).value = i;
+		if (i % 2 == 0)
+			objs.at(i).onEvent = script.address_of("DoubleValue");
+	}
+	REQUIRE(objs.for_each_event(&Object::onEvent));
+	for (size_t i = 0; i < 16; i++)
+		REQUIRE(objs.at(i).value == int((i % 2 == 0) ? i * 2 : i));
+}
+
+TEST_CASE("Typed return values", "[Events]")
+{
+	const auto program = build_and_load(R"M(
+	#include <api.h>
+
+	int main() {}
+
+	struct Health { int current; int max; };
+	struct Position { float x, y, z; };
+	struct Sample { long id; float value; };
+
+	extern "C" float get_speed() { return 1.5f; }
+	extern "C" double get_time(double t) { return t * 2.0; }
+	extern "C" Health get_health() { return {75, 100}; }
+	extern "C" Position get_position() { return {1.0f, 2.0f, 3.0f}; }
+	extern "C" Sample get_sample() { return {7, 0.25f}; }
+	extern "C" long get_negative() { return -5; }
+	)M");
+
+	struct Health { int current; int max; };
+	struct Position { float x, y, z; };
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	REQUIRE(script.call<float>("get_speed") == 1.5f);
+	REQUIRE(script.call<double>("get_time", 2.0) == 4.0);
+	REQUIRE(script.preempt<float>("get_speed") == 1.5f);
+	REQUIRE(script.call("get_negative") == -5);
+
+	/* Small structs are packed into a0 and a1 */
+	auto health = script.call<Health>("get_health");
+	REQUIRE(health);
+	REQUIRE(health->current == 75);
+	REQUIRE(health->max == 100);
+	auto pos = script.call<Position>("get_position");
+	REQUIRE(pos);
+	REQUIRE(pos->x == 1.0f);
+	REQUIRE(pos->z == 3.0f);
+
+	/* Mixed integer and floating-point members use a0 and fa0 */
+	auto sample = script.call<std::pair<long, float>>("get_sample");
+	REQUIRE(sample);
+	REQUIRE(sample->first == 7);
+	REQUIRE(sample->second == 0.25f);
+
+	/* Events return the type of the function */
+	Event<float()> speed(script, "get_speed");
+	REQUIRE(speed.call() == 1.5f);
+	Event<Health()> get_health(script, "get_health");
+	REQUIRE(get_health.call()->max == 100);
+	get_health.set_budget(10'000);
+	REQUIRE(get_health.call()->current == 75);
+}
+
+TEST_CASE("Argument arena", "[Events]")
+{
+	const auto program = build_and_load(R"M(
+	#include <api.h>
+
+	int main() {}
+
+	struct Data { int a, b; };
+	extern "C" long on_event(const char* name, const Data& data) {
+		return strlen(name) + data.a * data.b;
+	}
+	)M");
+
+	struct Data { int a, b; };
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	const auto name = script.intern("explosion");
+	REQUIRE(name.address != 0x0);
+	REQUIRE(name.size == 9);
+	/* Strings are only interned once */
+	REQUIRE(script.intern("explosion").address == name.address);
+	REQUIRE(script.intern("other").address != name.address);
+	REQUIRE(script.argument_arena().interned() == 2);
+
+	const auto data = script.place(Data {6, 7});
+	REQUIRE(script.argument_arena().frame_used() == sizeof(Data));
+	REQUIRE(script.call("on_event", name, data) == 9 + 42);
+
+	Event<long(const std::string&, const Data&)> ev(script, "on_event");
+	REQUIRE(ev.call(name, data) == 9 + 42);
+	/* The same as copying the arguments */
+	REQUIRE(ev.call("explosion", Data {6, 7}) == 9 + 42);
+
+	/* Placed objects are forgotten at the end of the frame */
+	script.reset_frame_arguments();
+	REQUIRE(script.argument_arena().frame_used() == 0);
+	REQUIRE(script.place(Data {1, 2}).address == data.address);
+}
+
+TEST_CASE("Events after snapshots and checkpoints", "[Events]")
+{
+	const auto program = build_and_load(R"M(
+	static int value = 0;
+	extern "C" int bump() {
+		return ++value;
+	}
+	int main() {
+	})M");
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	const auto* booted = &script.machine();
+
+	// The instance continues on a new machine, and events are created again
+	script.snapshot();
+	const auto* forked = &script.machine();
+	REQUIRE(forked != booted);
+	Event<int(), SharedScript> ev1(script, "bump");
+	REQUIRE(ev1.call() == 1);
+
+	script.checkpoint();
+	REQUIRE(&script.machine() != forked);
+	Event<int(), SharedScript> ev2(script, "bump");
+	REQUIRE(ev2.call() == 2);
+	script.rollback();
+	// Later checkpoints keep the machine
+	const auto* checkpointed = &script.machine();
+	script.checkpoint();
+	REQUIRE(&script.machine() == checkpointed);
+	REQUIRE(ev2.call() == 2);
+}
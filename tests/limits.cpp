@@ -1,4 +1,6 @@
 #include "codebuilder.hpp"
+#include <script/event.hpp>
+#include <script/script_faults.hpp>
 
 TEST_CASE("Out of instructions", "[Limits]")
 {
@@ -63,3 +65,137 @@ TEST_CASE("Recursive", "[Limits]")
 
 	REQUIRE(exit_called);
 }
+
+TEST_CASE("Instruction budgets", "[Limits]")
+{
+	const auto program = build_and_load(R"M(
+	extern "C" long spin(long n) {
+		for (volatile long i = 0; i < n; i++);
+		return n;
+	}
+
+	int main() {
+	})M");
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	const auto spin = script.address_of("spin");
+	REQUIRE(script.call_budget() == Script::MAX_CALL_INSTR);
+	REQUIRE(script.call(spin, 1000) == 1000);
+
+	// A small budget for this instance only
+	script.set_call_budget(5'000);
+	REQUIRE(!script.call(spin, 100'000));
+	REQUIRE(script.call(spin, 10) == 10);
+	// Calls with their own budget
+	REQUIRE(script.call_with_budget(10'000'000, spin, 100'000) == 100'000);
+
+	auto stats = script.call_stats(spin);
+	REQUIRE(stats.calls == 4);
+	REQUIRE(stats.overruns == 1);
+	REQUIRE(stats.instructions > 100'000);
+	REQUIRE(script.budget_overruns() == 1);
+
+	// Events can have their own budget, regardless of the Script
+	Event<long(long), SharedScript> ev(script, "spin");
+	ev.set_budget(10'000'000);
+	REQUIRE(ev.call(100'000) == 100'000);
+	ev.set_budget(0);
+	REQUIRE(!ev.call(100'000));
+	REQUIRE(ev.stats().calls == 6);
+	REQUIRE(ev.stats().overruns == 2);
+}
+
+TEST_CASE("Deferred fault reports", "[Limits]")
+{
+	const auto program = build_and_load(R"M(
+	extern "C" void spin() {
+		while (true) asm("" ::: "memory");
+	}
+	extern "C" void crash() {
+		*(volatile int *)0x1 = 0;
+	}
+
+	int main() {
+	})M");
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	script.set_call_budget(10'000);
+
+	FaultLog faults(1, 2);
+	Script::set_fault_log(&faults);
+	for (int i = 0; i < 4; i++)
+		REQUIRE(!script.call("spin"));
+	REQUIRE(!script.call("crash"));
+	Script::set_fault_log(nullptr);
+	REQUIRE(script.budget_overruns() == 4);
+
+	// Records are cheap, and can be inspected without printing them
+	std::vector<FaultRecord> records;
+	REQUIRE(faults.consume([&](const FaultRecord& record) {
+		records.push_back(record);
+	}) == 5);
+	REQUIRE(records.at(0).type == FaultRecord::Type::Timeout);
+	REQUIRE(records.at(0).address == script.address_of("spin"));
+	REQUIRE(records.at(0).script_hash == script.hash());
+	REQUIRE(std::string(records.at(0).script_name) == "MyScript");
+	REQUIRE(records.at(4).type == FaultRecord::Type::Machine);
+	REQUIRE(records.at(4).address == script.address_of("crash"));
+
+	// Printing is rate limited per fault site and per script
+	for (const auto& record : records)
+		REQUIRE(faults.record(record));
+	FILE* devnull = fopen("/dev/null", "w");
+	REQUIRE(faults.drain(devnull) == 5);
+	fclose(devnull);
+	REQUIRE(faults.suppressed() == 3);
+
+	// The ring buffer never grows
+	for (size_t i = 0; i < FaultLog::CAPACITY; i++)
+		REQUIRE(faults.record(records.at(0)));
+	REQUIRE(!faults.record(records.at(0)));
+	REQUIRE(faults.dropped() == 1);
+}
+
+TEST_CASE("Nested calls preserve the interrupted call", "[Limits]")
+{
+	const auto program = build_and_load(R"M(
+	#include <api.h>
+
+	extern "C" long clobber(long a, long b) {
+		return a * b;
+	}
+	extern "C" float fclobber(float a) {
+		return a * 2.0f;
+	}
+	extern "C" void fail_fs() {
+		/* Fail part-way, without restoring callee-saved registers */
+		asm volatile("fmv.w.x fs0, zero; fmv.w.x fs1, zero" ::: "fs0", "fs1");
+		__builtin_trap();
+	}
+	extern "C" float outer(float f, long n) {
+		const long a = n * 3;
+		const float g = f * 2.0f;
+		isys_empty(); /* Inlined dynamic call */
+		sys_empty();
+		return g + a;
+	}
+
+	int main() {
+	})M");
+
+	// The handler outlives the test, and must not refer to its stack
+	static int nested = 0;
+	nested = 0;
+	Script::set_dynamic_call("void sys_empty ()", [] (Script& script) {
+		// Nested calls clobber caller-saved registers
+		REQUIRE(script.call("clobber", 6, 7) == 42);
+		REQUIRE(script.call<float>("fclobber", 1.5f) == 3.0f);
+		// A failed nested call leaves fs0-fs11 as they were
+		REQUIRE(!script.call("fail_fs"));
+		nested++;
+	});
+
+	Script script {program, "MyScript", "/tmp/myscript"};
+	REQUIRE(script.call<float>("outer", 1.5f, 4L) == 15.0f);
+	REQUIRE(nested == 2);
+}
@@ -0,0 +1,56 @@
+#include "codebuilder.hpp"
+
+TEST_CASE("Dynamic call profiling", "[Profiling]")
+{
+	const auto program = build_and_load(R"M(
+	#include <api.h>
+
+	extern "C" void my_func() {
+		sys_empty();
+		sys_empty();
+		isys_empty();
+		DynamicCall("Test::profiled")();
+	}
+
+	int main() {
+	})M");
+
+	Script::set_dynamic_call("void sys_empty ()", [] (Script&) {});
+	Script::set_dynamic_call("Test::profiled", [] (Script&) {});
+	Script script {program, "MyScript", "/tmp/myscript"};
+	REQUIRE(script.call("my_func"));
+
+	// Inlined and opaque calls share the table index
+	const auto& profile = script.dyncall_profile();
+	uint64_t indexed_calls = 0;
+	for (const auto& counter : profile.by_index)
+		indexed_calls += counter.calls;
+	REQUIRE(indexed_calls == 3);
+	REQUIRE(profile.by_hash.size() == 1);
+	REQUIRE(profile.by_hash.begin()->second.calls == 1);
+
+	const auto table = script.dyncall_profile_table();
+	REQUIRE_THAT(table, Catch::Matchers::ContainsSubstring("void sys_empty ()"));
+	REQUIRE_THAT(table, Catch::Matchers::ContainsSubstring("Test::profiled"));
+	const auto json = script.dyncall_profile_json();
+	REQUIRE_THAT(json, Catch::Matchers::StartsWith("{\"name\": \"MyScript\""));
+	REQUIRE_THAT(json, Catch::Matchers::ContainsSubstring("\"histogram\": ["));
+
+	script.dyncall_profile().clear();
+	REQUIRE(script.dyncall_profile().by_index.empty());
+}
+
+TEST_CASE("Profiling deferred instances", "[Profiling]")
+{
+	const auto program = build_and_load(R"M(
+	int main() {
+	})M");
+
+	// Reading an empty profile does not boot the instance
+	Script script {program, "MyScript", "/tmp/myscript", false, nullptr,
+		Script::BootMode::Deferred};
+	REQUIRE_THAT(script.dyncall_profile_json(),
+		Catch::Matchers::Equals("{\"name\": \"MyScript\", \"dyncalls\": []}"));
+	REQUIRE(!script.dyncall_profile_table().empty());
+	REQUIRE(!script.is_booted());
+}